@@ -36,6 +36,7 @@
 #include <current.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * System call dispatcher.
@@ -139,6 +140,34 @@ syscall(struct trapframe *tf)
 	case SYS_execv:
 	  err = sys_execv((const userptr_t)tf->tf_a0,(userptr_t)tf->tf_a1);
 	  break;
+#if OPT_A3
+	case SYS_sbrk:
+	  err = sys_sbrk((intptr_t)tf->tf_a0, (vaddr_t *)&retval);
+	  break;
+	case SYS_mmap:
+	  err = sys_mmap((userptr_t)tf->tf_a0,
+			 (size_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int)tf->tf_a3,
+			 (vaddr_t *)&retval);
+	  break;
+	case SYS_munmap:
+	  err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+	  break;
+	case SYS_msync:
+	  err = sys_msync((userptr_t)tf->tf_a0,
+			  (size_t)tf->tf_a1,
+			  (int)tf->tf_a2);
+	  break;
+	case SYS_madvise:
+	  err = sys_madvise((userptr_t)tf->tf_a0,
+			    (size_t)tf->tf_a1,
+			    (int)tf->tf_a2);
+	  break;
+	case SYS_getmemusage:
+	  err = sys_getmemusage((pid_t)tf->tf_a0, (userptr_t)tf->tf_a1);
+	  break;
+#endif
 
 #endif // UW
 
@@ -40,55 +40,136 @@
 
 #include "opt-A3.h"
 
+#if OPT_A3
+#include <kern/mman.h>
+#include <array.h>
+#include <cpu.h>
+#include <synch.h>
+#include <thread.h>
+#include <platform/maxcpus.h>
+#include <uio.h>
+#include <vnode.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <swap.h>
+#include <zeropool.h>
+#include <vmtlb.h>
+#include <filemap.h>
+#include <kseg2.h>
+#include <clock.h>
+#include <uw-vmstats.h>
+#endif
+
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
  * enough to struggle off the ground.
+ *
+ * With OPT_A3 this becomes a paged VM: each address space has a
+ * two-level page table and a list of regions, and user pages are
+ * allocated one frame at a time on first touch in vm_fault, zeroed or
+ * read in from the executable. When memory runs out, vm_pageout
+ * evicts pages to swap.
  */
 
-/* under dumbvm, always have 48k of user stack */
+/*
+ * under dumbvm, always have 48k of user stack
+ * (A3 stacks grow; see addrspace.h)
+ */
 #define DUMBVM_STACKPAGES    12
 
+#if OPT_A3
+/* How many rounds of pageout an allocation may try before failing. */
+#define PAGEOUT_TRIES        8
+
+static bool vm_canpageout(void);
+static unsigned vm_pageout(void);
+static void as_wssthread(void *unused1, unsigned long unused2);
+#endif
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
 #if OPT_A3
-struct coremap *coremap;
 bool is_coremapped = false;
-int total_frames;
+
+/*
+ * ASIDs are allocated per CPU, since each CPU has its own TLB. They
+ * are handed out in order; when they run out the TLB is flushed and a
+ * new generation begins, which invalidates every ASID handed out in
+ * the last one. ASID 0 is never used.
+ */
+struct cpuasid {
+	uint32_t ca_next;		/* next ASID to hand out */
+	uint32_t ca_generation;
+};
+static struct cpuasid cpu_asids[MAXCPUS];
+
+/*
+ * The page table of the address space active on each CPU, or NULL.
+ * Read by the UTLB refill handler in exception-mips1.S, which walks
+ * it directly, so it must not be static.
+ */
+struct pagetable *utlb_pagetables[MAXCPUS];
+
+/*
+ * TLB shootdown counters, per CPU. Each CPU only updates its own, at
+ * splhigh or from the IPI handler, so there is no lock.
+ */
+struct shootdownstats {
+	unsigned ss_ipis;		/* IPIs sent */
+	unsigned ss_sent;		/* mappings sent */
+	unsigned ss_sentall;		/* full flushes asked for */
+	unsigned ss_received;		/* mappings invalidated for others */
+	unsigned ss_receivedall;	/* full flushes done for others */
+};
+static struct shootdownstats shootdown_stats[MAXCPUS];
+
+/*
+ * Every address space, for the working-set sampler and for reporting
+ * memory use. The lock only covers the array: it is taken before an
+ * as_lock, never while holding one.
+ */
+static struct array *as_all;
+static struct lock *as_all_lock;
 #endif
 
 void
 vm_bootstrap(void)
 {
 #if OPT_A3
-	paddr_t low, high;
-
-	// Get remaining memory
-	ram_getsize(&low, &high);
-
-	coremap = (struct coremap *) PADDR_TO_KVADDR(low);
+	unsigned i;
+	int result;
 
-	// Find necessary space for coremap
-	int total_size = high - low;
-	total_frames = total_size / PAGE_SIZE;
-
-	low += total_frames * sizeof(struct coremap);
-	while (low % PAGE_SIZE != 0) {
-		low += 1;
-	}
-	total_frames = (high - low) / PAGE_SIZE;
-
-	paddr_t start = low;
-	for (int i = 0; i < total_frames; i++) {
-		coremap[i].framestart = start;
-		coremap[i].is_used = false;
-		coremap[i].contiguous = false;
-		start += PAGE_SIZE;
+	for (i = 0; i < MAXCPUS; i++) {
+		cpu_asids[i].ca_next = 1;
+		cpu_asids[i].ca_generation = 1;
+		utlb_pagetables[i] = NULL;
 	}
+	/* The refill handler hardwires the page table geometry. */
+	COMPILE_ASSERT(PT_TABLE_SPAN == 0x400000);
+	COMPILE_ASSERT(sizeof(struct pagetable) == PT_DIR_ENTRIES * sizeof(pte_t *));
 
+	coremap_bootstrap();
 	is_coremapped = true;
+	kseg2_bootstrap();
+
+	vmtlb_bootstrap();
+	vmstats_init();
+	swap_bootstrap();
+	filemap_bootstrap();
+	zeropool_bootstrap();
+
+	as_all = array_create();
+	as_all_lock = lock_create("as_all");
+	if (as_all == NULL || as_all_lock == NULL) {
+		panic("vm: out of memory\n");
+	}
+	result = thread_fork("wss", NULL, as_wssthread, NULL, 0);
+	if (result) {
+		panic("vm: thread_fork failed: %s\n", strerror(result));
+	}
 #endif
 	/* Do nothing. */
 }
@@ -98,20 +179,32 @@ paddr_t
 getppages(unsigned long npages)
 {
 	paddr_t addr;
-
-	spinlock_acquire(&stealmem_lock);
-
 #if OPT_A3
+	int tries;
+
 	if (is_coremapped) {
-		addr = ram_getmem(coremap, total_frames, npages);
-	}
-	else {
-		addr = ram_stealmem(npages);
+		/* the coremap does its own locking */
+		for (tries = 0; tries < PAGEOUT_TRIES; tries++) {
+			addr = coremap_alloc(npages);
+			if (addr != 0) {
+				return addr;
+			}
+			/* Pre-zeroed frames are the cheapest to give up. */
+			if (zeropool_drain() > 0) {
+				continue;
+			}
+			if (!vm_canpageout() || vm_pageout() == 0) {
+				break;
+			}
+		}
+		return 0;
 	}
-#else
-	addr = ram_stealmem(npages);
 #endif
 
+	spinlock_acquire(&stealmem_lock);
+
+	addr = ram_stealmem(npages);
+
 	spinlock_release(&stealmem_lock);
 	return addr;
 }
@@ -121,6 +214,19 @@ vaddr_t
 alloc_kpages(int npages)
 {
 	paddr_t pa;
+#if OPT_A3
+	if (npages > 1 && is_coremapped) {
+		/*
+		 * Contiguous frames if there are some to be had without
+		 * paging out; otherwise scattered ones mapped in kseg2.
+		 */
+		pa = coremap_alloc(npages);
+		if (pa == 0) {
+			return kseg2_alloc(npages);
+		}
+		return PADDR_TO_KVADDR(pa);
+	}
+#endif
 	pa = getppages(npages);
 	if (pa==0) {
 		return 0;
@@ -133,62 +239,1528 @@ free_kpages(vaddr_t addr)
 {
 	/* nothing - leak the memory. */
 #if OPT_A3
-	spinlock_acquire(&stealmem_lock);
+	/* Memory stolen before the coremap existed is never returned. */
 	if (is_coremapped) {
-		if (!addr) {
-			spinlock_release(&stealmem_lock);
-			kprintf("Error: something occured from free_kpages\n");
+		/* Like kfree(NULL). */
+		if (addr == 0) {
+			return;
+		}
+		if (kseg2_owns(addr)) {
+			kseg2_free(addr);
 			return;
 		}
+		coremap_free(addr - MIPS_KSEG0);
+	}
 
-		int pos_found = -1;
-		paddr_t paddr = addr - MIPS_KSEG0;
-		// Find the addrs position to free
-		for (int i = 0; i < total_frames; i++) {
-			if (coremap[i].framestart == paddr) {
-				pos_found = i;
-				break;
-			}
+	return;
+#else	
+	(void)addr;
+#endif
+}
+
+#if OPT_A3
+/*
+ * User frames carry a reference count in the coremap so that forked
+ * address spaces can share them copy-on-write.
+ */
+
+/*
+ * Allocate a frame for a user page with one reference, paging
+ * something out if need be. Returns 0 if memory is exhausted.
+ */
+static
+paddr_t
+getupage(void)
+{
+	KASSERT(is_coremapped);
+	return getppages(1);
+}
+
+/* Same, but zero-filled: from the pool if possible. */
+static
+paddr_t
+getzeroupage(void)
+{
+	paddr_t paddr;
+
+	paddr = zeropool_get();
+	if (paddr != 0) {
+		return paddr;
+	}
+	paddr = getupage();
+	if (paddr != 0) {
+		zeropool_zero(paddr);
+	}
+	return paddr;
+}
+
+paddr_t
+alloc_upage(void)
+{
+	return getzeroupage();
+}
+
+/* Add a mapping to a frame already in use. */
+static
+void
+refupage(paddr_t paddr)
+{
+	coremap_incref(paddr);
+}
+
+/*
+ * Drop a mapping to a frame, freeing it with the last one. A private
+ * frame may still have a copy in swap; that goes too.
+ */
+static
+void
+freeupage(paddr_t paddr)
+{
+	unsigned slot;
+
+	slot = coremap_takeslot(paddr);
+	if (slot != SWAP_NOSLOT) {
+		swap_free(slot);
+	}
+	coremap_decref(paddr);
+}
+
+/* One more page of AS is resident. Called with as_lock held. */
+static
+void
+as_addrss(struct addrspace *as)
+{
+	struct memusage *mu = &as->as_usage;
+
+	mu->mu_rss++;
+	if (mu->mu_rss > mu->mu_peakrss) {
+		mu->mu_peakrss = mu->mu_rss;
+	}
+}
+
+/*
+ * Release the frame or swap slot behind PTE, a page of AS, if any,
+ * and clear it. Any TLB entry for the page is the caller's problem.
+ */
+static
+void
+pte_release(struct addrspace *as, pte_t *pte)
+{
+	if (*pte & PTE_VALID) {
+		freeupage(*pte & PTE_FRAME);
+		as->as_usage.mu_rss--;
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_free(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+}
+
+/*
+ * Give the page behind PTE a private, writable frame. If we hold the
+ * only reference the frame is simply taken over; otherwise it is
+ * copied and our reference to the shared frame dropped.
+ */
+static
+int
+cow_break(pte_t *pte)
+{
+	paddr_t oldpaddr, newpaddr;
+
+	KASSERT((*pte & (PTE_VALID | PTE_COW)) == (PTE_VALID | PTE_COW));
+	oldpaddr = *pte & PTE_FRAME;
+
+	if (coremap_refcount(oldpaddr) > 1) {
+		newpaddr = getupage();
+		if (newpaddr == 0) {
+			return ENOMEM;
+		}
+		/*
+		 * Getting the frame may have paged out, and a file page
+		 * can go even while shared (see as_unmapfile). If ours
+		 * did, the fault has to start over.
+		 */
+		if ((*pte & (PTE_VALID | PTE_FRAME)) !=
+		    (oldpaddr | PTE_VALID)) {
+			freeupage(newpaddr);
+			return EAGAIN;
 		}
+		memmove((void *)PADDR_TO_KVADDR(newpaddr),
+			(const void *)PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+		freeupage(oldpaddr);
+		*pte = newpaddr | (*pte & ~PTE_FRAME);
+		vmstats_inc(VMSTAT_COW_COPY);
+	}
+	else {
+		vmstats_inc(VMSTAT_COW_REUSE);
+	}
+	*pte &= ~PTE_COW;
+	return 0;
+}
 
-		if (pos_found < 0) {
-			spinlock_release(&stealmem_lock);
-			kprintf("Error: unable to find the addrs to free from coremap\n");
-			return;
+/*
+ * Get the page behind PTE ready to be written: break any sharing and
+ * mark it modified, which makes the copy in swap (if any) stale. Only
+ * for pages in writeable regions, since it also lets the refill
+ * handler map the page writable. Returns EAGAIN if the page was paged
+ * out meanwhile, in which case the access should just fault again.
+ */
+static
+int
+pte_makewritable(pte_t *pte)
+{
+	unsigned slot;
+	int result;
+
+	KASSERT(*pte & PTE_VALID);
+
+	if (*pte & PTE_COW) {
+		result = cow_break(pte);
+		if (result) {
+			return result;
 		}
-		
-		int i;
-		for (i = pos_found; i < total_frames; i++) {
-			if (!coremap[i].contiguous) {
-				break;
-			} else {
-				coremap[i].is_used = false;
-				coremap[i].contiguous = false;
+	}
+	if (!(*pte & PTE_MODIFIED)) {
+		slot = coremap_takeslot(*pte & PTE_FRAME);
+		if (slot != SWAP_NOSLOT) {
+			swap_free(slot);
+		}
+		*pte |= PTE_MODIFIED;
+	}
+	*pte |= PTE_DIRTY;
+	return 0;
+}
+
+/*
+ * Return the ASID of AS on this CPU, giving it a new one if it has
+ * none from the current generation. Called at splhigh.
+ */
+static
+uint32_t
+as_getasid(struct addrspace *as)
+{
+	struct cpuasid *ca;
+	unsigned cpu;
+
+	cpu = curcpu->c_number;
+	ca = &cpu_asids[cpu];
+	if (as->as_asidgen[cpu] != ca->ca_generation) {
+		if (ca->ca_next == NUM_ASID) {
+			vmtlb_flush();
+			ca->ca_generation++;
+			ca->ca_next = 1;
+		}
+		as->as_asid[cpu] = ca->ca_next++;
+		as->as_asidgen[cpu] = ca->ca_generation;
+	}
+	return as->as_asid[cpu];
+}
+
+/*
+ * Drop all of AS's TLB entries, on every CPU, by forgetting its ASIDs.
+ * If AS is the current address space it gets a new one right away.
+ */
+static
+void
+as_dropasids(struct addrspace *as)
+{
+	unsigned i;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		as->as_asidgen[i] = 0;
+	}
+	if (as == curproc_getas()) {
+		as_activate();
+	}
+}
+
+/*
+ * Drop this CPU's TLB entry for VADDR in AS, if it has one, and say
+ * whether it did. Entries on other CPUs are left alone; see tlbbatch
+ * below for when they matter.
+ */
+static
+bool
+tlb_invalidate_page(struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned cpu;
+	int spl;
+	bool found;
+
+	/* Keep the ASID and the TLB consistent. */
+	spl = splhigh();
+
+	found = false;
+	cpu = curcpu->c_number;
+	if (as->as_asidgen[cpu] == cpu_asids[cpu].ca_generation) {
+		found = vmtlb_drop(vaddr |
+				   (as->as_asid[cpu] << TLBHI_PIDSHIFT));
+	}
+
+	splx(spl);
+	return found;
+}
+
+/*
+ * Load a translation for VADDR in AS into the TLB, replacing any
+ * existing entry for the same page (e.g. a read-only one after a
+ * copy-on-write break). Returns true if another entry was evicted.
+ */
+static
+bool
+tlb_insert(struct addrspace *as, vaddr_t vaddr, uint32_t elo)
+{
+	bool replaced;
+	int spl;
+
+	/* Keep the ASID and the TLB consistent. */
+	spl = splhigh();
+	replaced = vmtlb_load(vaddr | (as_getasid(as) << TLBHI_PIDSHIFT), elo);
+	splx(spl);
+
+	return replaced;
+}
+
+/*
+ * Pages whose PTEs have been changed and whose TLB entries must go
+ * before their frames can be reused. Entries on this CPU are dropped
+ * as pages are added. An address space only runs with the ASID it had
+ * on its last CPU (see as_activate), so that is the only other CPU
+ * that can still use entries for it; tlbbatch_send sends each such
+ * CPU one IPI for the whole batch, or a full flush if there are more
+ * than TLBSHOOTDOWN_MAX pages, and waits for them all to finish.
+ *
+ * Operations on the current address space need none of this, since
+ * its last CPU is this one.
+ */
+struct tlbbatch {
+	struct tlbshootdown tb_maps[TLBSHOOTDOWN_MAX];
+	unsigned tb_num;		/* may exceed TLBSHOOTDOWN_MAX */
+	uint32_t tb_cpus;		/* one bit per CPU to send to */
+};
+
+static
+void
+tlbbatch_init(struct tlbbatch *tb)
+{
+	COMPILE_ASSERT(MAXCPUS <= 32);
+	tb->tb_num = 0;
+	tb->tb_cpus = 0;
+}
+
+/* Add VADDR in AS, whose PTE the caller has already changed. */
+static
+void
+tlbbatch_add(struct tlbbatch *tb, struct addrspace *as, vaddr_t vaddr)
+{
+	unsigned cpu;
+	bool here;
+	int spl;
+
+	/*
+	 * We can be moved to another CPU at any time, so only leave out
+	 * the CPU whose TLB we actually dropped the entry from.
+	 */
+	spl = splhigh();
+	tlb_invalidate_page(as, vaddr);
+	cpu = as->as_lastcpu;
+	here = cpu == curcpu->c_number;
+	splx(spl);
+
+	if (cpu == MAXCPUS || here ||
+	    as->as_asidgen[cpu] != cpu_asids[cpu].ca_generation) {
+		return;
+	}
+	if (tb->tb_num < TLBSHOOTDOWN_MAX) {
+		tb->tb_maps[tb->tb_num].ts_addrspace = as;
+		tb->tb_maps[tb->tb_num].ts_vaddr = vaddr;
+	}
+	tb->tb_num++;
+	tb->tb_cpus |= (uint32_t)1 << cpu;
+}
+
+/*
+ * Shoot down the batch on other CPUs and wait for them. The address
+ * spaces in it must stay alive until this returns.
+ *
+ * Interrupts are on throughout, so we may be moved onto one of the
+ * CPUs we send to. That's fine: waiting on our own CPU just takes the
+ * IPI we sent it, which does the shootdown here.
+ */
+static
+void
+tlbbatch_send(struct tlbbatch *tb)
+{
+	struct shootdownstats *ss;
+	struct cpu *target;
+	unsigned i;
+	int spl;
+
+	if (tb->tb_cpus == 0) {
+		return;
+	}
+	for (i = 0; i < MAXCPUS; i++) {
+		if (tb->tb_cpus & ((uint32_t)1 << i)) {
+			target = cpu_bynumber(i);
+			KASSERT(target != NULL);
+			ipi_tlbshootdown_batch(target, tb->tb_maps, tb->tb_num);
+		}
+	}
+
+	spl = splhigh();
+	ss = &shootdown_stats[curcpu->c_number];
+	for (i = 0; i < MAXCPUS; i++) {
+		if (tb->tb_cpus & ((uint32_t)1 << i)) {
+			ss->ss_ipis++;
+			if (tb->tb_num > TLBSHOOTDOWN_MAX) {
+				ss->ss_sentall++;
+			}
+			else {
+				ss->ss_sent += tb->tb_num;
 			}
 		}
-		coremap[i].is_used = false;
 	}
-	spinlock_release(&stealmem_lock);
+	splx(spl);
+
+	for (i = 0; i < MAXCPUS; i++) {
+		if (tb->tb_cpus & ((uint32_t)1 << i)) {
+			ipi_tlbshootdown_wait(cpu_bynumber(i));
+		}
+	}
+	tlbbatch_init(tb);
+}
+
+/*
+ * Find the region of AS containing VADDR, or NULL if VADDR is not
+ * mapped.
+ */
+static
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *rg;
+	unsigned i;
+
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * VADDR is in no region. If it is in the stack's reserved range, grow
+ * the stack down to the page containing it and return the stack
+ * region, unless that would leave less than a guard's worth of
+ * unmapped pages above the next region down. Called with as_lock.
+ */
+static
+struct region *
+as_growstack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack, *rg;
+	vaddr_t guard;
+	unsigned i;
+
+	vaddr &= PAGE_FRAME;
+
+	stack = NULL;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_stack) {
+			stack = rg;
+		}
+	}
+	if (stack == NULL || vaddr >= stack->rg_vbase ||
+	    vaddr < USERSTACK - STACK_MAXPAGES * PAGE_SIZE) {
+		return NULL;
+	}
+
+	guard = vaddr - STACK_GUARDPAGES * PAGE_SIZE;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg != stack && rg->rg_vbase < stack->rg_vbase &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > guard) {
+			return NULL;
+		}
+	}
+
+	stack->rg_npages += (stack->rg_vbase - vaddr) / PAGE_SIZE;
+	stack->rg_vbase = vaddr;
+	return stack;
+}
+
+/*
+ * If the page at VADDR in text region RG can come from the shared text
+ * cache, that is, it lies wholly within the segment's part of the
+ * file, store its file offset in *OFFSET and return true.
+ */
+static
+bool
+as_textpage(struct region *rg, vaddr_t vaddr, off_t *offset)
+{
+	if (rg->rg_textmap == NULL || vaddr < rg->rg_filevaddr ||
+	    vaddr + PAGE_SIZE > rg->rg_filevaddr + rg->rg_filesize) {
+		return false;
+	}
+	*offset = rg->rg_fileoffset + (vaddr - rg->rg_filevaddr);
+	return true;
+}
+
+/*
+ * The other way round: if RG, a file mapping or a text region, shows
+ * the page at OFFSET of its file's filemap, store where in *VADDR and
+ * return true.
+ */
+static
+bool
+as_filepage(struct region *rg, off_t offset, vaddr_t *vaddr)
+{
+	off_t textoffset;
+
+	if (rg->rg_map != NULL) {
+		if (offset < rg->rg_mapoffset ||
+		    offset - rg->rg_mapoffset >= rg->rg_npages * PAGE_SIZE) {
+			return false;
+		}
+		*vaddr = rg->rg_vbase + (offset - rg->rg_mapoffset);
+		return true;
+	}
+	if (offset < rg->rg_fileoffset ||
+	    offset - rg->rg_fileoffset >= rg->rg_filesize) {
+		return false;
+	}
+	*vaddr = rg->rg_filevaddr + (offset - rg->rg_fileoffset);
+	return as_textpage(rg, *vaddr, &textoffset);
+}
+
+/*
+ * Find NPAGES of unused address space for a file mapping, as high as
+ * possible below the stack's reserved range and guard, and above the
+ * heap. Returns 0 if there is no such gap. Called with as_lock.
+ */
+static
+vaddr_t
+as_findgap(struct addrspace *as, size_t npages)
+{
+	struct region *rg;
+	vaddr_t top, bottom, base;
+	size_t size;
+	unsigned i;
+
+	size = npages * PAGE_SIZE;
+	top = USERSTACK - (STACK_MAXPAGES + STACK_GUARDPAGES) * PAGE_SIZE;
+	bottom = PAGE_SIZE;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_heap) {
+			bottom = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		}
+	}
+
+ again:
+	if (top < bottom || top - bottom < size) {
+		return 0;
+	}
+	base = top - size;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase < top &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > base) {
+			/* in the way; try below it */
+			top = rg->rg_vbase;
+			goto again;
+		}
+	}
+	return base;
+}
+
+/*
+ * Write back the written pages among the NPAGES at VADDR in shared
+ * mapping RG, and map them read-only again so the next write is
+ * noticed. Returns the first error, if any. Called with as_lock.
+ */
+static
+int
+as_syncregion(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	      size_t npages)
+{
+	vaddr_t va;
+	pte_t *pte;
+	int result, err;
+
+	KASSERT(rg->rg_shared);
+
+	err = 0;
+	for (va = vaddr; va < vaddr + npages * PAGE_SIZE; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL ||
+		    (*pte & (PTE_VALID | PTE_MODIFIED)) !=
+		    (PTE_VALID | PTE_MODIFIED)) {
+			continue;
+		}
+		result = filemap_writeback(rg->rg_map,
+					   rg->rg_mapoffset + (va - rg->rg_vbase));
+		if (result) {
+			if (err == 0) {
+				err = result;
+			}
+			continue;
+		}
+		*pte &= ~(PTE_MODIFIED | PTE_DIRTY);
+		tlb_invalidate_page(as, va);
+	}
+	return err;
+}
+
+/*
+ * Read into the new zeroed frame PADDR, for the page at VADDR, the
+ * parts of it that come from files. Sets *FROMFILE if there were any.
+ * Segments need not start or end on page boundaries, so a page may
+ * take bytes from two of them.
+ */
+static
+int
+as_fill_page(struct addrspace *as, vaddr_t vaddr, paddr_t paddr,
+	     bool *fromfile)
+{
+	struct region *rg;
+	struct iovec iov;
+	struct uio u;
+	vaddr_t start, end;
+	unsigned i;
+	int result;
+
+	*fromfile = false;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vnode == NULL) {
+			continue;
+		}
+		start = vaddr > rg->rg_filevaddr ? vaddr : rg->rg_filevaddr;
+		end = rg->rg_filevaddr + rg->rg_filesize;
+		if (end > vaddr + PAGE_SIZE) {
+			end = vaddr + PAGE_SIZE;
+		}
+		if (start >= end) {
+			continue;
+		}
+
+		uio_kinit(&iov, &u,
+			  (void *)(PADDR_TO_KVADDR(paddr) + (start - vaddr)),
+			  end - start,
+			  rg->rg_fileoffset + (start - rg->rg_filevaddr),
+			  UIO_READ);
+		result = VOP_READ(rg->rg_vnode, &u);
+		if (result) {
+			return result;
+		}
+		if (u.uio_resid != 0) {
+			/* the file shrank under us */
+			return EIO;
+		}
+		*fromfile = true;
+	}
+	return 0;
+}
+
+/*
+ * Paging out can sleep, so only do it from a thread that could sleep
+ * anyway: not in an interrupt and not holding a spinlock.
+ */
+static
+bool
+vm_canpageout(void)
+{
+	return swap_enabled() && curthread != NULL &&
+		!curthread->t_in_interrupt && curthread->t_curspl == 0;
+}
+
+/* A page being paged out by vm_pageout. */
+struct victim {
+	struct addrspace *v_as;
+	vaddr_t v_vaddr;
+	paddr_t v_paddr;
+	pte_t *v_pte;
+	pte_t v_newpte;		/* what the PTE becomes once it's out */
+	bool v_locked;		/* we took v_as->as_lock */
+	bool v_done;
+};
+
+/*
+ * Evict up to SWAP_CLUSTER pages, chosen by the second-chance clock
+ * over the coremap, and free their frames. Returns how many frames
+ * were freed.
+ *
+ * A page mapped since the hand last passed it gets a second chance:
+ * its reference bit is cleared, and its TLB entry dropped so that the
+ * next use faults and sets the bit again. Most of those faults are
+ * now taken by the refill handler, which doesn't set the bit, so a
+ * page still in this CPU's TLB counts as referenced too. Otherwise we
+ * try to take the owner's lock; we never wait for it, since we may
+ * already hold another address space's lock. With the lock held, the
+ * PTE made invalid and the TLB entries shot down, the owner can no
+ * longer touch the page.
+ *
+ * Pages that are unmodified since they came in from swap still have
+ * their copy there, and pages never written at all are just zeroes,
+ * so neither needs writing. The dirty ones are written to adjacent
+ * swap slots in one I/O if possible, otherwise one by one.
+ *
+ * Pages of a file's cache may be mapped by any number of address
+ * spaces, so the clock hands those to filemap_evict, which finds the
+ * mappings and writes the page back to the file if need be, one page
+ * at a time.
+ */
+static
+unsigned
+vm_pageout(void)
+{
+	struct victim v[SWAP_CLUSTER];
+	paddr_t dirty[SWAP_CLUSTER];
+	struct tlbbatch tb;
+	struct victim *vp;
+	struct addrspace *as;
+	struct filemap *fm;
+	vaddr_t vaddr;
+	off_t offset;
+	paddr_t paddr;
+	pte_t *pte;
+	bool referenced, locked;
+	unsigned nv, nfile, ndirty, scanned, slot, nfreed, i, j;
+	unsigned maxscan;
+
+	/* Two sweeps' worth: the first may only clear reference bits. */
+	maxscan = 2 * (coremap_nframes() + SWAP_CLUSTER);
+
+	tlbbatch_init(&tb);
+	nv = 0;
+	nfile = 0;
+	for (scanned = 0; nv + nfile < SWAP_CLUSTER && scanned < maxscan;
+	     scanned++) {
+		paddr = coremap_clock(&as, &vaddr, &fm, &offset, &referenced);
+		if (paddr == 0) {
+			break;
+		}
+		if (fm != NULL) {
+			if (referenced) {
+				coremap_unbusy(paddr, false);
+			}
+			else if (filemap_evict(fm, offset, paddr)) {
+				nfile++;
+			}
+			continue;
+		}
+		if (tlb_invalidate_page(as, vaddr) || referenced) {
+			coremap_unbusy(paddr, false);
+			continue;
+		}
+
+		if (lock_do_i_hold(as->as_lock)) {
+			locked = false;
+		}
+		else if (lock_tryacquire(as->as_lock)) {
+			locked = true;
+		}
+		else {
+			coremap_unbusy(paddr, false);
+			continue;
+		}
+
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte == NULL || (*pte & PTE_SWAPPED) ||
+		    (*pte & (PTE_VALID | PTE_FRAME)) != (paddr | PTE_VALID)) {
+			/* stale owner information */
+			if (locked) {
+				lock_release(as->as_lock);
+			}
+			coremap_unbusy(paddr, false);
+			continue;
+		}
+
+		*pte &= ~(PTE_VALID | PTE_REF);
+		tlbbatch_add(&tb, as, vaddr);
+
+		vp = &v[nv++];
+		vp->v_as = as;
+		vp->v_vaddr = vaddr;
+		vp->v_paddr = paddr;
+		vp->v_pte = pte;
+		vp->v_locked = locked;
+		vp->v_done = false;
+	}
+
+	/*
+	 * The owners may be running elsewhere. Once their TLB entries
+	 * are gone nothing can write to the pages behind our back.
+	 */
+	tlbbatch_send(&tb);
+
+	/* Clean pages can go right away. */
+	ndirty = 0;
+	for (i = 0; i < nv; i++) {
+		vp = &v[i];
+		if (*vp->v_pte & PTE_MODIFIED) {
+			dirty[ndirty++] = vp->v_paddr;
+			continue;
+		}
+		slot = coremap_takeslot(vp->v_paddr);
+		vp->v_newpte = slot == SWAP_NOSLOT ? 0 : PTE_SWAP(slot);
+		vp->v_done = true;
+	}
+
+	/* Write the dirty ones as one cluster if there is room. */
+	if (ndirty > 1 && swap_alloc(ndirty, &slot) == 0) {
+		if (swap_write(slot, dirty, ndirty) == 0) {
+			for (i = 0, j = 0; i < nv; i++) {
+				vp = &v[i];
+				if (!vp->v_done) {
+					vp->v_newpte = PTE_SWAP(slot + j++);
+					vp->v_done = true;
+				}
+			}
+		}
+		else {
+			for (j = 0; j < ndirty; j++) {
+				swap_free(slot + j);
+			}
+		}
+	}
+	for (i = 0; i < nv; i++) {
+		vp = &v[i];
+		if (vp->v_done) {
+			continue;
+		}
+		if (swap_alloc(1, &slot)) {
+			continue;
+		}
+		if (swap_write(slot, &vp->v_paddr, 1)) {
+			swap_free(slot);
+			continue;
+		}
+		vp->v_newpte = PTE_SWAP(slot);
+		vp->v_done = true;
+	}
+
+	/*
+	 * Install the new PTEs and free the frames; pages we failed to
+	 * write stay where they were. Locks are dropped last, since a
+	 * lock may cover several victims.
+	 */
+	nfreed = 0;
+	for (i = 0; i < nv; i++) {
+		vp = &v[i];
+		if (!vp->v_done) {
+			*vp->v_pte |= PTE_VALID;
+			coremap_unbusy(vp->v_paddr, false);
+			continue;
+		}
+		vmstats_inc(*vp->v_pte & PTE_MODIFIED ?
+			    VMSTAT_EVICT_DIRTY : VMSTAT_EVICT_CLEAN);
+		*vp->v_pte = vp->v_newpte;
+		vp->v_as->as_usage.mu_rss--;
+		coremap_unbusy(vp->v_paddr, true);
+		coremap_decref(vp->v_paddr);
+		nfreed++;
+	}
+	for (i = 0; i < nv; i++) {
+		if (v[i].v_locked) {
+			lock_release(v[i].v_as->as_lock);
+		}
+	}
+
+	return nfreed + nfile;
+}
+
+/*
+ * Called by filemap_evict with the filemap locked, so RG is still
+ * there. Like vm_pageout, we never wait for AS's lock.
+ */
+int
+as_unmapfile(struct addrspace *as, struct region *rg, off_t offset,
+	     paddr_t paddr, bool *modified)
+{
+	struct tlbbatch tb;
+	vaddr_t vaddr;
+	pte_t *pte;
+	bool locked;
+	int result;
+
+	if (lock_do_i_hold(as->as_lock)) {
+		locked = false;
+	}
+	else if (lock_tryacquire(as->as_lock)) {
+		locked = true;
+	}
+	else {
+		return EBUSY;
+	}
+
+	result = 0;
+	if (!as_filepage(rg, offset, &vaddr)) {
+		goto done;
+	}
+	/* Private mappings may have their own copy by now. */
+	pte = pt_lookup(as->as_pt, vaddr, false);
+	if (pte == NULL ||
+	    (*pte & (PTE_VALID | PTE_FRAME)) != (paddr | PTE_VALID)) {
+		goto done;
+	}
+	/* Still in this CPU's TLB counts as in use; see vm_pageout. */
+	if (tlb_invalidate_page(as, vaddr)) {
+		result = EBUSY;
+		goto done;
+	}
+
+	if (rg->rg_shared && (*pte & PTE_MODIFIED)) {
+		*modified = true;
+	}
+	/* The filemap's own reference keeps the frame meanwhile. */
+	pte_release(as, pte);
+	tlbbatch_init(&tb);
+	tlbbatch_add(&tb, as, vaddr);
+	tlbbatch_send(&tb);
+
+ done:
+	if (locked) {
+		lock_release(as->as_lock);
+	}
+	return result;
+}
+#endif /* OPT_A3 */
+
+#if OPT_A3
+/*
+ * Called from interprocessor_interrupt, so already at splhigh. The
+ * sender waits for us, which keeps the address space alive.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	vmtlb_flush();
+	/*
+	 * This is also how vmtlb_setpolicy stops the refill handler;
+	 * the next as_activate starts it again if the policy allows.
+	 */
+	if (!vmtlb_fastrefill()) {
+		utlb_pagetables[curcpu->c_number] = NULL;
+	}
+	shootdown_stats[curcpu->c_number].ss_receivedall++;
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	struct addrspace *as;
+	unsigned cpu;
+
+	as = ts->ts_addrspace;
+	cpu = curcpu->c_number;
+	if (as->as_asidgen[cpu] == cpu_asids[cpu].ca_generation) {
+		vmtlb_drop(ts->ts_vaddr |
+			   (as->as_asid[cpu] << TLBHI_PIDSHIFT));
+	}
+	shootdown_stats[cpu].ss_received++;
+}
+
+void
+vm_tlbshootdown_printstats(void)
+{
+	struct shootdownstats *ss;
+	unsigned i;
+
+	/* Unlocked: the counters belong to their CPUs. */
+	kprintf("TLB shootdowns (at most %u pages per IPI):\n",
+		TLBSHOOTDOWN_MAX);
+	for (i = 0; i < MAXCPUS; i++) {
+		ss = &shootdown_stats[i];
+		if (ss->ss_ipis == 0 && ss->ss_received == 0 &&
+		    ss->ss_receivedall == 0) {
+			continue;
+		}
+		kprintf("    cpu%u: sent %u IPIs, %u pages, %u flushes; "
+			"received %u pages, %u flushes\n", i, ss->ss_ipis,
+			ss->ss_sent, ss->ss_sentall, ss->ss_received,
+			ss->ss_receivedall);
+	}
+}
+#else
+void
+vm_tlbshootdown_all(void)
+{
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	(void)ts;
+	panic("dumbvm tried to do tlb shootdown?!\n");
+}
+#endif /* OPT_A3 */
+
+#if OPT_A3
+/* Largest fault-around window; 0 turns it off. */
+static volatile unsigned faultaround_max = FAULTAROUND_DEFAULT;
+
+int
+vm_setfaultaround(unsigned maxpages)
+{
+	if (maxpages > FAULTAROUND_LIMIT) {
+		return EINVAL;
+	}
+	faultaround_max = maxpages;
+	return 0;
+}
+
+unsigned
+vm_faultaround(void)
+{
+	return faultaround_max;
+}
+
+/*
+ * Fault-around: after a miss at VADDR in RG, also load the TLB with
+ * the resident pages that follow it, so a sequential sweep takes one
+ * fault per window rather than one per page. Pages not resident are
+ * left for vm_fault, and so is everything when the refill handler is
+ * on, since it takes resident misses itself.
+ *
+ * The window starts at one page and doubles, up to faultaround_max,
+ * whenever a fault lands on the page just past the last window, which
+ * also means the sweep went through that window without faulting: its
+ * pages are counted as hits. Any other fault drops it back to one, or
+ * to the maximum in a MADV_SEQUENTIAL region. MADV_RANDOM regions get
+ * none. Called with as_lock held.
+ */
+static
+void
+as_faultaround(struct addrspace *as, struct region *rg, vaddr_t vaddr)
+{
+	vaddr_t va, top;
+	pte_t *pte;
+	unsigned max, n;
+
+	max = faultaround_max;
+	if (max == 0 || rg->rg_advice == MADV_RANDOM) {
+		return;
+	}
+	vaddr &= PAGE_FRAME;
+
+	if (vaddr == as->as_faend && as->as_faend != 0) {
+		for (va = as->as_fastart; va < as->as_faend; va += PAGE_SIZE) {
+			vmstats_inc(VMSTAT_FAULTAROUND_HIT);
+		}
+		as->as_fawindow *= 2;
+	}
+	else if (rg->rg_advice == MADV_SEQUENTIAL) {
+		as->as_fawindow = max;
+	}
+	else {
+		as->as_fawindow = 1;
+	}
+	if (as->as_fawindow > max) {
+		as->as_fawindow = max;
+	}
+
+	top = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	va = vaddr + PAGE_SIZE;
+	for (n = 0; n < as->as_fawindow && va < top; n++) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL || !(*pte & PTE_VALID)) {
+			break;
+		}
+		/* a guess: it may never be used */
+		*pte |= PTE_REF;
+		tlb_insert(as, va, *pte & (PTE_FRAME | PTE_VALID | PTE_DIRTY));
+		vmstats_inc(VMSTAT_FAULTAROUND_LOAD);
+		va += PAGE_SIZE;
+	}
+	as->as_fastart = vaddr + PAGE_SIZE;
+	as->as_faend = va;
+}
+
+/*
+ * Take one working-set sample of AS: count the pages used since the
+ * last one, by their PTE_REF bits, and clear the bits. The refill
+ * handler won't load a PTE without the bit, so the TLB entries have
+ * to go too, and the next use of each page faults and sets it again.
+ * Called with as_lock held.
+ */
+static
+void
+as_samplewss(struct addrspace *as)
+{
+	struct tlbbatch tb;
+	vaddr_t va;
+	pte_t *pte;
+	unsigned n;
+
+	tlbbatch_init(&tb);
+	n = 0;
+	va = 0;
+	while ((pte = pt_next(as->as_pt, &va)) != NULL) {
+		if (*pte & PTE_REF) {
+			*pte &= ~PTE_REF;
+			tlbbatch_add(&tb, as, va);
+			n++;
+		}
+		va += PAGE_SIZE;
+	}
+	tlbbatch_send(&tb);
+	as->as_usage.mu_wss = n;
+}
+
+/*
+ * The working-set sampler: every WSS_INTERVAL seconds, sample every
+ * address space we can lock without waiting. One that is busy keeps
+ * its last estimate.
+ */
+static
+void
+as_wssthread(void *unused1, unsigned long unused2)
+{
+	struct addrspace *as;
+	unsigned i;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(WSS_INTERVAL);
+
+		lock_acquire(as_all_lock);
+		for (i = 0; i < array_num(as_all); i++) {
+			as = array_get(as_all, i);
+			if (!lock_tryacquire(as->as_lock)) {
+				continue;
+			}
+			as_samplewss(as);
+			lock_release(as->as_lock);
+		}
+		lock_release(as_all_lock);
+	}
+}
+
+/*
+ * The process AS is the address space of, or NULL if none (yet). Called
+ * with as_all_lock held, which keeps the process from being destroyed:
+ * it loses its address space first.
+ */
+static
+struct proc *
+as_owner(struct addrspace *as)
+{
+	struct proc *p;
+	bool current;
+
+	p = as->as_proc;
+	if (p == NULL) {
+		return NULL;
+	}
+	spinlock_acquire(&p->p_lock);
+	current = p->p_addrspace == as;
+	spinlock_release(&p->p_lock);
+	return current ? p : NULL;
+}
+
+/*
+ * The counters are read without as_lock: each is a single word, and
+ * this is only a report.
+ */
+int
+as_getusage(pid_t pid, struct memusage *mu)
+{
+	struct addrspace *as;
+	struct proc *p;
+	unsigned i;
+
+	lock_acquire(as_all_lock);
+	for (i = 0; i < array_num(as_all); i++) {
+		as = array_get(as_all, i);
+		p = as_owner(as);
+		if (p == NULL || p->p_id != pid) {
+			continue;
+		}
+		mu->mu_rss = as->as_usage.mu_rss;
+		mu->mu_wss = as->as_usage.mu_wss;
+		mu->mu_peakrss = p->p_peakrss;
+		mu->mu_faults = p->p_faults;
+		mu->mu_majfaults = p->p_majfaults;
+		lock_release(as_all_lock);
+		return 0;
+	}
+	lock_release(as_all_lock);
+	return ESRCH;
+}
+
+void
+as_printusage(void)
+{
+	struct addrspace *as;
+	struct proc *p;
+	unsigned i;
+
+	kprintf("%5s %-16s %6s %6s %6s %8s %8s\n", "pid", "name", "rss",
+		"peak", "wss", "faults", "major");
+	lock_acquire(as_all_lock);
+	for (i = 0; i < array_num(as_all); i++) {
+		as = array_get(as_all, i);
+		p = as_owner(as);
+		if (p == NULL) {
+			continue;
+		}
+		kprintf("%5d %-16s %6u %6u %6u %8u %8u\n", (int)p->p_id,
+			p->p_name, as->as_usage.mu_rss, p->p_peakrss,
+			as->as_usage.mu_wss, p->p_faults, p->p_majfaults);
+	}
+	lock_release(as_all_lock);
+	kprintf("(sizes in pages; wss over the last %d s)\n", WSS_INTERVAL);
+}
+
+/*
+ * Bring in the page at VADDR in RG, whose PTE is PTE and not valid,
+ * from wherever it is: swap, a mapped file, the shared text, or (on
+ * first touch) a zeroed frame filled in from the executable. Sets
+ * *MAJOR if that meant reading from disk. A page brought in ahead of
+ * use (PREFETCH) is counted as such rather than as a fault. The frame
+ * isn't given to the pager (coremap_touch) here, so the caller can
+ * still use it. Called with as_lock held.
+ */
+static
+int
+as_pagein(struct addrspace *as, struct region *rg, vaddr_t vaddr,
+	  pte_t *pte, bool prefetch, bool *major)
+{
+	paddr_t paddr;
+	unsigned slot, stat;
+	bool writeable, fromfile, fromelf;
+	off_t fileoffset;
+	int result;
+
+	KASSERT(!(*pte & PTE_VALID));
+
+	/* Text stays writable until load_elf has filled it in. */
+	writeable = rg->rg_writeable || !as->as_complete;
+	fromelf = false;
+
+	if (*pte & PTE_SWAPPED) {
+		/* Bring it back, leaving the copy in swap until written. */
+		slot = PTE_SLOT(*pte);
+		paddr = getupage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = swap_read(slot, paddr);
+		if (result) {
+			freeupage(paddr);
+			return result;
+		}
+		coremap_setslot(paddr, slot);
+		*pte = paddr | PTE_VALID;
+		stat = VMSTAT_PAGE_FAULT_DISK;
+	}
+	else if (rg->rg_map != NULL) {
+		/*
+		 * Mapped file: map the file's cached frame, shared
+		 * outright or copy-on-write.
+		 */
+		result = filemap_getpage(rg->rg_map, rg->rg_mapoffset +
+					 (vaddr - rg->rg_vbase),
+					 &paddr, &fromfile);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		if (rg->rg_writeable && !rg->rg_shared) {
+			*pte |= PTE_COW;
+		}
+		/* if not from the file, it was already in memory */
+		stat = fromfile ? VMSTAT_PAGE_FAULT_DISK : VMSTAT_TLB_RELOAD;
+	}
+	else if (!writeable && as_textpage(rg, vaddr, &fileoffset)) {
+		/* Text: share the frame with everyone running this file. */
+		result = filemap_getpage(rg->rg_textmap, fileoffset, &paddr,
+					 &fromfile);
+		if (result) {
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		fromelf = fromfile;
+		stat = fromfile ? VMSTAT_PAGE_FAULT_DISK : VMSTAT_TLB_RELOAD;
+	}
+	else {
+		/*
+		 * First touch: back the page with a fresh zeroed frame,
+		 * reading in whatever part of it is in the executable.
+		 */
+		paddr = getzeroupage();
+		if (paddr == 0) {
+			return ENOMEM;
+		}
+		result = as_fill_page(as, vaddr, paddr, &fromfile);
+		if (result) {
+			freeupage(paddr);
+			return result;
+		}
+		*pte = paddr | PTE_VALID;
+		fromelf = fromfile;
+		stat = fromfile ? VMSTAT_PAGE_FAULT_DISK :
+			VMSTAT_PAGE_FAULT_ZERO;
+	}
+
+	as_addrss(as);
+	if (prefetch) {
+		vmstats_inc(VMSTAT_PREFETCH);
+	}
+	else {
+		if (fromelf) {
+			vmstats_inc(VMSTAT_ELF_FILE_READ);
+		}
+		vmstats_inc(stat);
+	}
+	*major = stat == VMSTAT_PAGE_FAULT_DISK;
+	return 0;
+}
+
+/*
+ * MADV_SEQUENTIAL read-ahead, after a fault at VADDR in RG brought a
+ * page in. The next SEQ_READAHEAD pages not yet resident are brought
+ * in too, so a sweep takes one fault per batch; they are marked
+ * referenced, so the refill handler (or fault-around) can load them
+ * without a trip through vm_fault. Pages out in swap are left to
+ * vm_fault: swap is read a page at a time either way. Nothing is read
+ * ahead when memory is short.
+ *
+ * The page SEQ_BEHIND pages back, which a sweep is done with, is made
+ * the pager's next choice instead: its reference bit and TLB entry go,
+ * so the clock takes it the first time round rather than the second.
+ * Called with as_lock held.
+ */
+static
+void
+as_readahead(struct addrspace *as, struct region *rg, vaddr_t vaddr)
+{
+	vaddr_t va, top;
+	pte_t *pte;
+	unsigned n;
+	bool major;
+
+	va = vaddr - SEQ_BEHIND * PAGE_SIZE;
+	if (vaddr >= rg->rg_vbase + SEQ_BEHIND * PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte != NULL && (*pte & PTE_VALID)) {
+			coremap_deactivate(*pte & PTE_FRAME);
+			tlb_invalidate_page(as, va);
+		}
+	}
+
+	if (coremap_freeframes() < 2 * SEQ_READAHEAD) {
+		return;
+	}
+	top = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	va = vaddr + PAGE_SIZE;
+	for (n = 0; n < SEQ_READAHEAD && va < top; n++, va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, true);
+		if (pte == NULL) {
+			break;
+		}
+		if (*pte & (PTE_VALID | PTE_SWAPPED)) {
+			continue;
+		}
+		if (as_pagein(as, rg, va, pte, true, &major)) {
+			break;
+		}
+		*pte |= PTE_REF;
+		coremap_touch(*pte & PTE_FRAME, as, va);
+	}
+}
+
+/* The VMSTAT_FAULT_* counter for faults in RG. */
+static
+unsigned
+region_faultstat(struct region *rg)
+{
+	if (rg->rg_map != NULL) {
+		return VMSTAT_FAULT_MMAP;
+	}
+	if (rg->rg_stack) {
+		return VMSTAT_FAULT_STACK;
+	}
+	if (rg->rg_heap) {
+		return VMSTAT_FAULT_HEAP;
+	}
+	return rg->rg_writeable ? VMSTAT_FAULT_DATA : VMSTAT_FAULT_TEXT;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct region *rg;
+	pte_t *pte;
+	paddr_t paddr;
+	uint32_t ehi, elo;
+	bool writeable, resident, major;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (faultaddress >= MIPS_KSEG2) {
+		/* Large kernel allocations; see kseg2.h. No locks here. */
+		return kseg2_fault(faultaddress);
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	lock_acquire(as->as_lock);
+
+	rg = as_find_region(as, faultaddress);
+	if (rg == NULL) {
+		rg = as_growstack(as, faultaddress);
+		if (rg == NULL) {
+			lock_release(as->as_lock);
+			return EFAULT;
+		}
+	}
+	/* Text stays writable until load_elf has filled it in. */
+	writeable = rg->rg_writeable || !as->as_complete;
+	vmstats_inc(region_faultstat(rg));
+
+	if (faulttype == VM_FAULT_READONLY) {
+		/*
+		 * A write hit a read-only TLB entry. That is legal for a
+		 * writeable region: the page is either shared
+		 * copy-on-write or has not been written since it was
+		 * paged in. Make it writable and retry.
+		 */
+		if (!writeable) {
+			lock_release(as->as_lock);
+			return EROFS;
+		}
+		pte = pt_lookup(as->as_pt, faultaddress, false);
+		if (pte != NULL && (*pte & PTE_VALID)) {
+			result = pte_makewritable(pte);
+			if (result) {
+				lock_release(as->as_lock);
+				return result == EAGAIN ? 0 : result;
+			}
+			*pte |= PTE_REF;
+			coremap_touch(*pte & PTE_FRAME, as, faultaddress);
+			tlb_insert(as, faultaddress,
+				   *pte & (PTE_FRAME | PTE_VALID | PTE_DIRTY));
+			lock_release(as->as_lock);
+			return 0;
+		}
+		/* Paged out since the TLB entry was loaded. */
+		faulttype = VM_FAULT_WRITE;
+	}
+
+	vmstats_inc(VMSTAT_TLB_FAULT);
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	resident = (*pte & PTE_VALID) != 0;
+	if (resident) {
+		/* Resident; the TLB just lost track of it. */
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+	}
+	else {
+		result = as_pagein(as, rg, faultaddress, pte, false, &major);
+		if (result) {
+			lock_release(as->as_lock);
+			return result;
+		}
+		as->as_usage.mu_faults++;
+		curproc->p_faults++;
+		if (major) {
+			as->as_usage.mu_majfaults++;
+			curproc->p_majfaults++;
+		}
+	}
+
+	/*
+	 * Pages are mapped read-only until written so we know which
+	 * ones need writing out, but a write fault may as well skip that.
+	 */
+	if (faulttype == VM_FAULT_WRITE && writeable) {
+		result = pte_makewritable(pte);
+		if (result) {
+			lock_release(as->as_lock);
+			return result == EAGAIN ? 0 : result;
+		}
+	}
+	paddr = *pte & PTE_FRAME;
 
-	return;
-#else	
-	(void)addr;
-#endif
-}
+	/* make sure it's page-aligned */
+	KASSERT((paddr & PAGE_FRAME) == paddr);
 
-void
-vm_tlbshootdown_all(void)
-{
-	panic("dumbvm tried to do tlb shootdown?!\n");
-}
+	ehi = faultaddress;
+	*pte |= PTE_REF;
+	elo = *pte & (PTE_FRAME | PTE_VALID | PTE_DIRTY);
 
-void
-vm_tlbshootdown(const struct tlbshootdown *ts)
-{
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
-}
+	/*
+	 * From here the pager may take the page. Read-ahead below
+	 * allocates, and can page out even this page; if so the
+	 * eviction's shootdown drops the entry we load, and the next
+	 * access just faults it back in.
+	 */
+	coremap_touch(paddr, as, faultaddress);
 
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+	if (tlb_insert(as, faultaddress, elo)) {
+		vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	}
+	else {
+		vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+	}
+	if (!resident && rg->rg_advice == MADV_SEQUENTIAL) {
+		as_readahead(as, rg, faultaddress);
+	}
+	if (!vmtlb_fastrefill()) {
+		as_faultaround(as, rg, faultaddress);
+	}
+	if (as->as_usage.mu_rss > curproc->p_peakrss) {
+		curproc->p_peakrss = as->as_usage.mu_rss;
+	}
+	lock_release(as->as_lock);
+	return 0;
+}
+#else
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -312,15 +1884,62 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	return EFAULT;
 #endif
 }
+#endif /* OPT_A3 */
 
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+#if OPT_A3
+	unsigned i;
+	int result;
+#endif
 	if (as==NULL) {
 		return NULL;
 	}
 
+#if OPT_A3
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = array_create();
+	if (as->as_regions == NULL) {
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("as");
+	if (as->as_lock == NULL) {
+		array_destroy(as->as_regions);
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+	as->as_complete = 0;
+	for (i = 0; i < MAXCPUS; i++) {
+		as->as_asidgen[i] = 0;
+	}
+	as->as_lastcpu = MAXCPUS;
+	as->as_heapbreak = 0;
+	as->as_fastart = 0;
+	as->as_faend = 0;
+	as->as_fawindow = 1;
+	bzero(&as->as_usage, sizeof(as->as_usage));
+	as->as_proc = NULL;
+
+	lock_acquire(as_all_lock);
+	result = array_add(as_all, as, NULL);
+	lock_release(as_all_lock);
+	if (result) {
+		lock_destroy(as->as_lock);
+		array_destroy(as->as_regions);
+		pt_destroy(as->as_pt);
+		kfree(as);
+		return NULL;
+	}
+#else
 	as->as_vbase1 = 0;
 	as->as_pbase1 = 0;
 	as->as_npages1 = 0;
@@ -328,8 +1947,6 @@ as_create(void)
 	as->as_pbase2 = 0;
 	as->as_npages2 = 0;
 	as->as_stackpbase = 0;
-#if OPT_A3
-	as->as_complete = 0;
 #endif
 
 	return as;
@@ -339,9 +1956,65 @@ void
 as_destroy(struct addrspace *as)
 {
 #if OPT_A3
-	free_kpages(PADDR_TO_KVADDR(as->as_pbase1));
-	free_kpages(PADDR_TO_KVADDR(as->as_pbase2));
-	free_kpages(PADDR_TO_KVADDR(as->as_stackpbase));
+	struct region *rg;
+	vaddr_t va;
+	pte_t *pte;
+
+	unsigned i;
+
+	/* Out of sight of the sampler and getmemusage first. */
+	lock_acquire(as_all_lock);
+	for (i = 0; i < array_num(as_all); i++) {
+		if (array_get(as_all, i) == as) {
+			array_remove(as_all, i);
+			break;
+		}
+	}
+	lock_release(as_all_lock);
+
+	/*
+	 * Write back shared mappings, then release every resident page
+	 * and swap slot, then the table itself. Holding the lock keeps
+	 * the pager away meanwhile.
+	 */
+	lock_acquire(as->as_lock);
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_shared) {
+			/* nobody to report an error to */
+			(void)as_syncregion(as, rg, rg->rg_vbase,
+					    rg->rg_npages);
+		}
+	}
+	va = 0;
+	while ((pte = pt_next(as->as_pt, &va)) != NULL) {
+		pte_release(as, pte);
+		va += PAGE_SIZE;
+	}
+	lock_release(as->as_lock);
+
+	/* The pager may look at the table and lock until we're off here. */
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_map != NULL) {
+			filemap_put(rg->rg_map, rg);
+		}
+		if (rg->rg_textmap != NULL) {
+			filemap_put(rg->rg_textmap, rg);
+		}
+	}
+	pt_destroy(as->as_pt);
+	lock_destroy(as->as_lock);
+
+	while (array_num(as->as_regions) > 0) {
+		rg = array_get(as->as_regions, 0);
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+		array_remove(as->as_regions, 0);
+	}
+	array_destroy(as->as_regions);
 #endif
 	kfree(as);
 }
@@ -349,6 +2022,39 @@ as_destroy(struct addrspace *as)
 void
 as_activate(void)
 {
+#if OPT_A3
+	struct addrspace *as;
+	unsigned cpu;
+	int spl;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		as_deactivate();
+		return;
+	}
+
+	/*
+	 * With ASIDs the TLB doesn't need flushing on a context switch;
+	 * we just tell the processor which entries are ours.
+	 */
+	spl = splhigh();
+
+	cpu = curcpu->c_number;
+	if (as->as_lastcpu != cpu) {
+		/*
+		 * What we left in this CPU's TLB on an earlier visit may
+		 * have gone stale since, so start over with a new ASID.
+		 */
+		as->as_asidgen[cpu] = 0;
+		as->as_lastcpu = cpu;
+	}
+	tlb_setasid(as_getasid(as));
+	as->as_proc = curproc;
+	/* The refill handler bypasses the replacement policy. */
+	utlb_pagetables[cpu] = vmtlb_fastrefill() ? as->as_pt : NULL;
+
+	splx(spl);
+#else
 	int i, spl;
 	struct addrspace *as;
 
@@ -368,12 +2074,22 @@ as_activate(void)
 	}
 
 	splx(spl);
+#endif /* OPT_A3 */
 }
 
 void
 as_deactivate(void)
 {
+#if OPT_A3
+	int spl;
+
+	/* Keep the refill handler out of a table that may be freed. */
+	spl = splhigh();
+	utlb_pagetables[curcpu->c_number] = NULL;
+	splx(spl);
+#else
 	/* nothing */
+#endif
 }
 
 int
@@ -381,6 +2097,10 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
 	size_t npages; 
+#if OPT_A3
+	struct region *rg;
+	int result;
+#endif
 
 	/* Align the region. First, the base... */
 	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
@@ -391,6 +2111,39 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
+#if OPT_A3
+	if (vaddr + sz > USERSPACETOP || vaddr + sz < vaddr) {
+		return EFAULT;
+	}
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_readable = readable != 0;
+	rg->rg_writeable = writeable != 0;
+	rg->rg_executable = executable != 0;
+	rg->rg_vnode = NULL;
+	rg->rg_fileoffset = 0;
+	rg->rg_filevaddr = 0;
+	rg->rg_filesize = 0;
+	rg->rg_stack = false;
+	rg->rg_heap = false;
+	rg->rg_map = NULL;
+	rg->rg_mapoffset = 0;
+	rg->rg_shared = false;
+	rg->rg_textmap = NULL;
+	rg->rg_advice = MADV_NORMAL;
+
+	result = array_add(as->as_regions, rg, NULL);
+	if (result) {
+		kfree(rg);
+		return result;
+	}
+	return 0;
+#else
 	/* We don't use these - all pages are read-write */
 	(void)readable;
 	(void)writeable;
@@ -413,18 +2166,64 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	 */
 	kprintf("dumbvm: Warning: too many regions\n");
 	return EUNIMP;
+#endif /* OPT_A3 */
 }
 
+#if OPT_A3
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	       off_t offset, size_t filesize)
+{
+	struct region *rg;
+	unsigned i;
+
+	if (filesize == 0) {
+		/* all zero-fill */
+		return 0;
+	}
+
+	/*
+	 * Segments may share a page at their ends, so look for the
+	 * most recently defined region, which is this segment's.
+	 */
+	rg = NULL;
+	for (i = array_num(as->as_regions); i > 0; i--) {
+		rg = array_get(as->as_regions, i - 1);
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr < rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+			break;
+		}
+		rg = NULL;
+	}
+	if (rg == NULL || rg->rg_vnode != NULL || vaddr + filesize < vaddr ||
+	    vaddr + filesize > rg->rg_vbase + rg->rg_npages * PAGE_SIZE) {
+		return EFAULT;
+	}
+
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_fileoffset = offset;
+	rg->rg_filevaddr = vaddr;
+	rg->rg_filesize = filesize;
+	return 0;
+}
+#else
 static
 void
 as_zero_region(paddr_t paddr, unsigned npages)
 {
 	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
 }
+#endif
 
 int
 as_prepare_load(struct addrspace *as)
 {
+#if OPT_A3
+	/* Nothing to do: pages are allocated as load_elf touches them. */
+	(void)as;
+	return 0;
+#else
 	KASSERT(as->as_pbase1 == 0);
 	KASSERT(as->as_pbase2 == 0);
 	KASSERT(as->as_stackpbase == 0);
@@ -449,14 +2248,61 @@ as_prepare_load(struct addrspace *as)
 	as_zero_region(as->as_stackpbase, DUMBVM_STACKPAGES);
 
 	return 0;
+#endif /* OPT_A3 */
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
 #if OPT_A3
+	struct region *rg;
+	pte_t *pte;
+	vaddr_t va, top;
+	unsigned i;
+	int result;
+
+	/*
+	 * The heap starts out empty, just above the executable. Text
+	 * laid out in the file the way it is in memory can be shared;
+	 * if there is no memory for the cache, it just won't be.
+	 */
+	top = 0;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE > top) {
+			top = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		}
+		if (rg->rg_vnode != NULL && !rg->rg_writeable &&
+		    rg->rg_filevaddr % PAGE_SIZE ==
+		    rg->rg_fileoffset % PAGE_SIZE) {
+			rg->rg_textmap = filemap_get(rg->rg_vnode, as, rg);
+		}
+	}
+	result = as_define_region(as, top, 0, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	rg = array_get(as->as_regions, array_num(as->as_regions) - 1);
+	rg->rg_heap = true;
+	as->as_heapbreak = top;
+
+	/*
+	 * Text pages may have been mapped writable during the load.
+	 * Take that back in the PTEs, for the refill handler, and drop
+	 * the TLB entries.
+	 */
+	lock_acquire(as->as_lock);
 	as->as_complete = 1;
-	as_activate();
+	va = 0;
+	while ((pte = pt_next(as->as_pt, &va)) != NULL) {
+		rg = as_find_region(as, va);
+		if (rg != NULL && !rg->rg_writeable) {
+			*pte &= ~PTE_DIRTY;
+		}
+		va += PAGE_SIZE;
+	}
+	lock_release(as->as_lock);
+	as_dropasids(as);
 #else
 	(void)as;
 #endif
@@ -466,22 +2312,426 @@ as_complete_load(struct addrspace *as)
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
+#if OPT_A3
+	struct region *rg;
+	int result;
+
+	/* Only the top of the stack; vm_fault grows it as needed. */
+	result = as_define_region(as, USERSTACK - STACK_INITPAGES * PAGE_SIZE,
+				  STACK_INITPAGES * PAGE_SIZE, 1, 1, 0);
+	if (result) {
+		return result;
+	}
+	rg = array_get(as->as_regions, array_num(as->as_regions) - 1);
+	rg->rg_stack = true;
+#else
 	KASSERT(as->as_stackpbase != 0);
+#endif
 
 	*stackptr = USERSTACK;
 	return 0;
 }
 
+#if OPT_A3
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct region *heap, *rg;
+	vaddr_t newbreak, oldtop, newtop, limit, va;
+	pte_t *pte;
+	unsigned i;
+
+	lock_acquire(as->as_lock);
+
+	/*
+	 * Find the heap, and how far up it can go: not into any region
+	 * above it, nor into the stack's reserved range and guard.
+	 */
+	heap = NULL;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_heap) {
+			heap = rg;
+		}
+	}
+	if (heap == NULL) {
+		/* not loaded yet */
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	limit = USERSTACK - (STACK_MAXPAGES + STACK_GUARDPAGES) * PAGE_SIZE;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg != heap && rg->rg_vbase >= heap->rg_vbase &&
+		    rg->rg_vbase < limit) {
+			limit = rg->rg_vbase;
+		}
+	}
+
+	newbreak = as->as_heapbreak + amount;
+	if (amount < 0 &&
+	    (newbreak > as->as_heapbreak || newbreak < heap->rg_vbase)) {
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+	if (amount > 0 && (newbreak < as->as_heapbreak || newbreak > limit)) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+
+	/* Give back the pages no longer in the heap. */
+	oldtop = heap->rg_vbase + heap->rg_npages * PAGE_SIZE;
+	newtop = ROUNDUP(newbreak, PAGE_SIZE);
+	for (va = newtop; va < oldtop; va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte != NULL && *pte != 0) {
+			pte_release(as, pte);
+			tlb_invalidate_page(as, va);
+		}
+	}
+
+	heap->rg_npages = (newtop - heap->rg_vbase) / PAGE_SIZE;
+	*oldbreak = as->as_heapbreak;
+	as->as_heapbreak = newbreak;
+
+	lock_release(as->as_lock);
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, struct vnode *v, size_t len, int readable,
+	int writeable, int executable, bool shared, vaddr_t *vaddr)
+{
+	struct region *rg;
+	struct filemap *fm;
+	vaddr_t base;
+	size_t npages;
+	int result;
+
+	if (len == 0 || len > USERSPACETOP) {
+		return EINVAL;
+	}
+	npages = DIVROUNDUP(len, PAGE_SIZE);
+
+	lock_acquire(as->as_lock);
+	base = as_findgap(as, npages);
+	if (base == 0) {
+		lock_release(as->as_lock);
+		return ENOMEM;
+	}
+	result = as_define_region(as, base, npages * PAGE_SIZE,
+				  readable, writeable, executable);
+	if (result) {
+		lock_release(as->as_lock);
+		return result;
+	}
+	rg = array_get(as->as_regions, array_num(as->as_regions) - 1);
+	fm = filemap_get(v, as, rg);
+	if (fm == NULL) {
+		array_remove(as->as_regions, array_num(as->as_regions) - 1);
+		lock_release(as->as_lock);
+		kfree(rg);
+		return ENOMEM;
+	}
+	/* Nothing is mapped until it is touched. */
+	rg->rg_map = fm;
+	rg->rg_shared = shared;
+	lock_release(as->as_lock);
+
+	*vaddr = base;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t va;
+	pte_t *pte;
+	unsigned i;
+	int result;
+
+	lock_acquire(as->as_lock);
+
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (rg->rg_map != NULL && rg->rg_vbase == vaddr &&
+		    rg->rg_npages == DIVROUNDUP(len, PAGE_SIZE)) {
+			break;
+		}
+	}
+	if (i == array_num(as->as_regions)) {
+		/* only whole mappings can be removed */
+		lock_release(as->as_lock);
+		return EINVAL;
+	}
+
+	result = 0;
+	if (rg->rg_shared) {
+		result = as_syncregion(as, rg, rg->rg_vbase, rg->rg_npages);
+	}
+	for (va = rg->rg_vbase; va < rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+	     va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte != NULL && *pte != 0) {
+			pte_release(as, pte);
+			tlb_invalidate_page(as, va);
+		}
+	}
+	array_remove(as->as_regions, i);
+
+	lock_release(as->as_lock);
+
+	filemap_put(rg->rg_map, rg);
+	kfree(rg);
+	return result;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct region *rg;
+	vaddr_t start, end, rgend;
+	unsigned i;
+	int result, err;
+
+	if (vaddr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	end = vaddr + len;
+	if (end < vaddr) {
+		return ENOMEM;
+	}
+
+	lock_acquire(as->as_lock);
+	err = 0;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		if (!rg->rg_shared) {
+			continue;
+		}
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		start = vaddr > rg->rg_vbase ? vaddr : rg->rg_vbase;
+		if (start >= end || start >= rgend) {
+			continue;
+		}
+		result = as_syncregion(as, rg, start,
+			DIVROUNDUP((end < rgend ? end : rgend) - start,
+				   PAGE_SIZE));
+		if (result && err == 0) {
+			err = result;
+		}
+	}
+	lock_release(as->as_lock);
+
+	return err;
+}
+
+int
+as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len, int advice)
+{
+	struct region *rg;
+	vaddr_t start, end, rgend, va;
+	pte_t *pte;
+	unsigned i;
+	bool major, found;
+
+	if (vaddr % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	end = vaddr + len;
+	if (end < vaddr) {
+		return ENOMEM;
+	}
+
+	lock_acquire(as->as_lock);
+	found = false;
+	for (i = 0; i < array_num(as->as_regions); i++) {
+		rg = array_get(as->as_regions, i);
+		rgend = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		start = vaddr > rg->rg_vbase ? vaddr : rg->rg_vbase;
+		if (start >= end || start >= rgend) {
+			continue;
+		}
+		if (end < rgend) {
+			rgend = end;
+		}
+		found = true;
+
+		switch (advice) {
+		    case MADV_NORMAL:
+		    case MADV_RANDOM:
+		    case MADV_SEQUENTIAL:
+			/* regions aren't split, so this covers all of it */
+			rg->rg_advice = advice;
+			break;
+
+		    case MADV_WILLNEED:
+			/*
+			 * Only a hint, so stop once nothing is free. Other
+			 * threads can still use up the frames, and then
+			 * as_pagein pages out like any other fault.
+			 */
+			for (va = start; va < rgend; va += PAGE_SIZE) {
+				if (coremap_freeframes() == 0) {
+					break;
+				}
+				pte = pt_lookup(as->as_pt, va, true);
+				if (pte == NULL) {
+					break;
+				}
+				if (*pte & PTE_VALID) {
+					continue;
+				}
+				if (as_pagein(as, rg, va, pte, true, &major)) {
+					break;
+				}
+				*pte |= PTE_REF;
+				coremap_touch(*pte & PTE_FRAME, as, va);
+			}
+			break;
+
+		    case MADV_DONTNEED:
+			/* Shared mappings keep what was written. */
+			if (rg->rg_shared) {
+				(void)as_syncregion(as, rg, start,
+					(rgend - start) / PAGE_SIZE);
+			}
+			for (va = start; va < rgend; va += PAGE_SIZE) {
+				pte = pt_lookup(as->as_pt, va, false);
+				if (pte == NULL || *pte == 0) {
+					continue;
+				}
+				if (*pte & PTE_VALID) {
+					vmstats_inc(VMSTAT_DONTNEED);
+				}
+				pte_release(as, pte);
+				tlb_invalidate_page(as, va);
+			}
+			break;
+		}
+	}
+	lock_release(as->as_lock);
+
+	return found ? 0 : ENOMEM;
+}
+#endif /* OPT_A3 */
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *new;
+#if OPT_A3
+	struct region *rg, *nrg;
+	vaddr_t va;
+	pte_t *pte, *npte;
+	paddr_t paddr;
+	unsigned i, slot;
+	int result;
+#endif
 
 	new = as_create();
 	if (new==NULL) {
 		return ENOMEM;
 	}
 
+#if OPT_A3
+	for (i = 0; i < array_num(old->as_regions); i++) {
+		rg = array_get(old->as_regions, i);
+		nrg = kmalloc(sizeof(struct region));
+		if (nrg == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*nrg = *rg;
+		/* as_destroy only lets go of what we got */
+		nrg->rg_map = NULL;
+		nrg->rg_textmap = NULL;
+		result = array_add(new->as_regions, nrg, NULL);
+		if (result) {
+			kfree(nrg);
+			as_destroy(new);
+			return result;
+		}
+		if (nrg->rg_vnode != NULL) {
+			VOP_INCREF(nrg->rg_vnode);
+		}
+		if (rg->rg_map != NULL) {
+			result = filemap_addmap(rg->rg_map, new, nrg);
+			if (result) {
+				as_destroy(new);
+				return result;
+			}
+			nrg->rg_map = rg->rg_map;
+		}
+		if (rg->rg_textmap != NULL) {
+			result = filemap_addmap(rg->rg_textmap, new, nrg);
+			if (result) {
+				as_destroy(new);
+				return result;
+			}
+			nrg->rg_textmap = rg->rg_textmap;
+		}
+	}
+	new->as_complete = old->as_complete;
+	new->as_heapbreak = old->as_heapbreak;
+
+	/*
+	 * Share every resident page with the child instead of copying
+	 * it. Pages in writeable regions become copy-on-write in both
+	 * address spaces, except in shared mappings; vm_fault copies
+	 * them on the first write.
+	 * Shared pages don't keep a copy in swap, so they count as
+	 * modified from now on.
+	 *
+	 * Pages that are out in swap are read back into a frame of the
+	 * child's own.
+	 */
+	lock_acquire(old->as_lock);
+	va = 0;
+	while ((pte = pt_next(old->as_pt, &va)) != NULL) {
+		npte = pt_lookup(new->as_pt, va, true);
+		if (npte == NULL) {
+			result = ENOMEM;
+			goto fail;
+		}
+		if (*pte & PTE_VALID) {
+			rg = as_find_region(old, va);
+			KASSERT(rg != NULL);
+			if (rg->rg_writeable && !rg->rg_shared) {
+				*pte = (*pte | PTE_COW) & ~PTE_DIRTY;
+			}
+			slot = coremap_takeslot(*pte & PTE_FRAME);
+			if (slot != SWAP_NOSLOT) {
+				swap_free(slot);
+				*pte |= PTE_MODIFIED;
+			}
+			refupage(*pte & PTE_FRAME);
+			*npte = *pte & ~PTE_REF;
+			as_addrss(new);
+		}
+		else if (*pte & PTE_SWAPPED) {
+			paddr = getupage();
+			if (paddr == 0) {
+				result = ENOMEM;
+				goto fail;
+			}
+			result = swap_read(PTE_SLOT(*pte), paddr);
+			if (result) {
+				freeupage(paddr);
+				goto fail;
+			}
+			*npte = paddr | PTE_VALID | PTE_MODIFIED;
+			coremap_touch(paddr, new, va);
+			as_addrss(new);
+		}
+		va += PAGE_SIZE;
+	}
+	lock_release(old->as_lock);
+
+	/* The parent may still have writable TLB entries for these. */
+	as_dropasids(old);
+#else
 	new->as_vbase1 = old->as_vbase1;
 	new->as_npages1 = old->as_npages1;
 	new->as_vbase2 = old->as_vbase2;
@@ -508,7 +2758,16 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	memmove((void *)PADDR_TO_KVADDR(new->as_stackpbase),
 		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
 		DUMBVM_STACKPAGES*PAGE_SIZE);
+#endif /* OPT_A3 */
 	
 	*ret = new;
 	return 0;
+
+#if OPT_A3
+ fail:
+	lock_release(old->as_lock);
+	as_destroy(new);
+	as_dropasids(old);
+	return result;
+#endif
 }
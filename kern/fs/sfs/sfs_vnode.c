@@ -44,6 +44,14 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <kmem_cache.h>
+
+/* In-memory vnodes; made on first use, under the big lock. */
+static struct kmem_cache *sfs_vnodecache;
+#endif
 
 /* At bottom of file */
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
@@ -953,7 +961,11 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
+#if OPT_A3
+	kmem_cache_free(sfs_vnodecache, sv);
+#else
 	kfree(sv);
+#endif
 
 	/* Done */
 	return 0;
@@ -1110,14 +1122,15 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any regular file can be mapped; the VM system
+ * pages it in and out with VOP_READ and VOP_WRITE.
  */
 static
 int
 sfs_mmap(struct vnode *v   /* add stuff as needed */)
 {
 	(void)v;
-	return EUNIMP;
+	return 0;
 }
 
 /*
@@ -1685,7 +1698,20 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
+#if OPT_A3
+	KASSERT(vfs_biglock_do_i_hold());
+	if (sfs_vnodecache == NULL) {
+		sfs_vnodecache = kmem_cache_create("sfs_vnode",
+						   sizeof(struct sfs_vnode),
+						   NULL, NULL);
+		if (sfs_vnodecache == NULL) {
+			return ENOMEM;
+		}
+	}
+	sv = kmem_cache_alloc(sfs_vnodecache);
+#else
 	sv = kmalloc(sizeof(struct sfs_vnode));
+#endif
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1699,7 +1725,11 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
+#if OPT_A3
+		kmem_cache_free(sfs_vnodecache, sv);
+#else
 		kfree(sv);
+#endif
 		return result;
 	}
 
@@ -1736,7 +1766,11 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+#if OPT_A3
+		kmem_cache_free(sfs_vnodecache, sv);
+#else
 		kfree(sv);
+#endif
 		return result;
 	}
 
@@ -1747,7 +1781,11 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
+#if OPT_A3
+		kmem_cache_free(sfs_vnodecache, sv);
+#else
 		kfree(sv);
+#endif
 		return result;
 	}
 
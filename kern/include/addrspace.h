@@ -36,9 +36,104 @@
 
 
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-A3.h"
 
 struct vnode;
+#if OPT_A3
+#include <kern/time.h>
+#include <kern/resource.h>
+
+struct array;
+struct filemap;
+struct lock;
+struct pagetable;
+struct proc;
+
+/*
+ * Region - a page-aligned range of the address space with uniform
+ * permissions, as set up by as_define_region and as_define_stack.
+ * Pages within a region are allocated on first touch.
+ *
+ * A region loaded from an executable also records where its contents
+ * come from: rg_filesize bytes of rg_vnode at rg_fileoffset, which
+ * appear at rg_filevaddr (not necessarily page-aligned). Those pages
+ * are read in from the file on first touch; the rest are zero-filled.
+ *
+ * The stack region starts at STACK_INITPAGES below USERSTACK and grows
+ * down in vm_fault when a page below it is touched, up to
+ * STACK_MAXPAGES. It never grows to within STACK_GUARDPAGES of another
+ * region, so those pages stay unmapped and a runaway stack faults
+ * instead of running into whatever lies below.
+ *
+ * The heap region starts empty at the first page above the executable
+ * and is grown and shrunk by sbrk. Its pages are allocated on first
+ * touch like any other; those given back are freed at once.
+ *
+ * A mapped file region (mmap) takes its pages from the file's filemap,
+ * starting at rg_mapoffset, instead. With rg_shared the frames
+ * themselves are mapped and written back to the file on msync and
+ * munmap, or when the pager evicts them; otherwise they are mapped
+ * copy-on-write.
+ *
+ * Text regions loaded from an executable also get the file's filemap,
+ * in rg_textmap, once the load is complete. Text pages that lie wholly
+ * within the segment's part of the file are then mapped read-only from
+ * there, so every process running the same executable shares them.
+ * The pager can evict them like any other page; they are read in from
+ * the file again on the next touch. The partial pages at either end
+ * are still filled privately.
+ *
+ * rg_advice is the access pattern given by madvise. A sequential
+ * region gets the full fault-around window at once, reads ahead on
+ * page faults, and has pages far enough behind the fault evicted
+ * first; a random one gets no fault-around.
+ */
+struct region {
+  vaddr_t rg_vbase;             /* first address in the region */
+  size_t rg_npages;             /* length in pages */
+  bool rg_readable;
+  bool rg_writeable;
+  bool rg_executable;
+  struct vnode *rg_vnode;       /* backing file, or NULL */
+  off_t rg_fileoffset;
+  vaddr_t rg_filevaddr;
+  size_t rg_filesize;
+  bool rg_stack;                /* grows down on demand */
+  bool rg_heap;                 /* moved by sbrk */
+  struct filemap *rg_map;       /* mapped file, or NULL */
+  off_t rg_mapoffset;
+  bool rg_shared;               /* MAP_SHARED */
+  struct filemap *rg_textmap;   /* shared text pages, or NULL */
+  int rg_advice;                /* MADV_NORMAL, _RANDOM or _SEQUENTIAL */
+};
+
+#define STACK_INITPAGES   1
+#define STACK_MAXPAGES    4096  /* 16M */
+#define STACK_GUARDPAGES  1
+
+/*
+ * Fault-around window limits, in pages. vm_fault may also load the
+ * TLB with up to the current maximum (see vm_setfaultaround) of the
+ * resident pages following the one that faulted.
+ */
+#define FAULTAROUND_DEFAULT  8
+#define FAULTAROUND_LIMIT    32  /* half the TLB */
+
+/*
+ * MADV_SEQUENTIAL: pages brought in ahead of a page fault, and how far
+ * behind it a page has to be to be considered done with.
+ */
+#define SEQ_READAHEAD  16
+#define SEQ_BEHIND     32
+
+/*
+ * Seconds between working-set samples. Each sample counts the pages
+ * used since the last one and makes the next use of every page fault
+ * again (see PTE_REF), so this trades accuracy for overhead.
+ */
+#define WSS_INTERVAL  1
+#endif
 
 
 /* 
@@ -49,6 +144,21 @@ struct vnode;
  */
 
 struct addrspace {
+#if OPT_A3
+  struct pagetable *as_pt;      /* page table, see pagetable.h */
+  struct array *as_regions;     /* struct region *, in definition order */
+  int as_complete;              /* set once the executable is loaded */
+  struct lock *as_lock;         /* held while changing as_pt */
+  uint32_t as_asid[MAXCPUS];    /* TLB address space ID on each cpu... */
+  uint32_t as_asidgen[MAXCPUS]; /* ...valid if still that cpu's generation */
+  unsigned as_lastcpu;          /* cpu it was last activated on */
+  vaddr_t as_heapbreak;         /* end of the heap, as seen by sbrk */
+  vaddr_t as_fastart;           /* last fault-around window... */
+  vaddr_t as_faend;             /* ...and the page after it */
+  unsigned as_fawindow;         /* pages to try to load next time */
+  struct memusage as_usage;     /* under as_lock; see kern/resource.h */
+  struct proc *as_proc;         /* process it was last activated for */
+#else
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
   size_t as_npages1;
@@ -56,8 +166,6 @@ struct addrspace {
   paddr_t as_pbase2;
   size_t as_npages2;
   paddr_t as_stackpbase;
-#if OPT_A3
-  int as_complete;
 #endif
 };
 
@@ -86,6 +194,10 @@ struct addrspace {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_define_file - (A3) say that FILESIZE bytes of file V at OFFSET
+ *                appear at VADDR, within a region already defined.
+ *                They are paged in on demand. Takes a reference to V.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -95,6 +207,39 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_sbrk   - (A3) move the end of the heap by AMOUNT bytes and hand
+ *                back the old end. Returns ENOMEM if the heap would
+ *                run into another region and EINVAL if it would end
+ *                below its start.
+ *
+ *    as_mmap   - (A3) map LEN bytes of file V, from the start, at an
+ *                unused address below the stack and hand it back.
+ *
+ *    as_munmap - (A3) remove the mapping at VADDR, which must be a
+ *                whole mapping of LEN bytes, writing back shared pages
+ *                that were written.
+ *
+ *    as_msync  - (A3) write back the written pages of the shared
+ *                mappings within LEN bytes at VADDR.
+ *
+ *    as_madvise - (A3) apply madvise ADVICE to the pages within LEN
+ *                bytes at VADDR; see kern/mman.h. Returns ENOMEM if
+ *                no region overlaps them.
+ *
+ *    as_getusage - (A3) fill in *MU for the process with pid PID, from
+ *                its address space and its lifetime counters. Returns
+ *                ESRCH if it has no address space.
+ *
+ *    as_printusage - (A3) print the memory use of every process.
+ *
+ *    as_unmapfile - (A3) for the pager (see filemap_evict): if RG in
+ *                AS maps the page at OFFSET of its file, and with
+ *                frame PADDR, take it out and shoot down its TLB
+ *                entries, setting *MODIFIED if it was written through
+ *                a shared mapping. The next touch faults it back in.
+ *                Returns EBUSY, leaving it, if AS's lock is held
+ *                elsewhere or the page is in use.
  */
 
 struct addrspace *as_create(void);
@@ -108,9 +253,29 @@ int               as_define_region(struct addrspace *as,
                                    int readable, 
                                    int writeable,
                                    int executable);
+#if OPT_A3
+int               as_define_file(struct addrspace *as, vaddr_t vaddr,
+                                 struct vnode *v, off_t offset,
+                                 size_t filesize);
+#endif
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if OPT_A3
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, struct vnode *v, size_t len,
+                          int readable, int writeable, int executable,
+                          bool shared, vaddr_t *vaddr);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t vaddr, size_t len);
+int               as_madvise(struct addrspace *as, vaddr_t vaddr, size_t len,
+                             int advice);
+int               as_getusage(pid_t pid, struct memusage *mu);
+void              as_printusage(void);
+int               as_unmapfile(struct addrspace *as, struct region *rg,
+                               off_t offset, paddr_t paddr, bool *modified);
+#endif
 
 
 /*
@@ -0,0 +1,139 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page allocator.
+ *
+ * Once the VM system is up, all RAM not used by the kernel image or
+ * stolen during boot is managed here as a binary buddy system: free
+ * frames are kept in power-of-two blocks, aligned to their size, on
+ * one free list per order. Allocation splits the smallest sufficient
+ * block and freeing coalesces with free buddies, so both are
+ * O(log n). The entry for a physical address is found by index
+ * arithmetic.
+ *
+ * Frames handed out for user pages also carry a reference count, so
+ * they can be shared between address spaces (copy-on-write fork).
+ *
+ * Single-page allocations, which are nearly all of them, go through a
+ * small per-CPU cache of free frames instead. A cache is refilled from
+ * the buddy lists PAGECACHE_BATCH frames at a time when it runs dry and
+ * drained by the same amount when it grows past PAGECACHE_HIGH, so the
+ * global coremap lock is only taken once per batch.
+ *
+ * kmalloc records its descriptor for each page it carves into small
+ * blocks here too, so kfree finds the page a block belongs to in
+ * constant time.
+ *
+ * For page replacement the coremap also records which address space
+ * maps each private user page, or which file cache holds each file
+ * page, and whether the page has been mapped since the clock hand last
+ * passed it. The VM system does the rest: see vm_pageout in dumbvm.c
+ * and filemap_evict.
+ */
+
+#include <vm.h>
+
+struct addrspace;
+struct filemap;
+
+/* Largest block managed, as log2 of the number of pages (16M). */
+#define COREMAP_MAXORDER 12
+
+/* Per-CPU cache capacity and default watermarks, in frames. */
+#define PAGECACHE_SIZE   64
+#define PAGECACHE_HIGH   32
+#define PAGECACHE_BATCH  16
+
+/*
+ * coremap_bootstrap - take over the memory reported by ram_getsize.
+ *                     Called once from vm_bootstrap.
+ *
+ * coremap_alloc     - allocate NPAGES physically contiguous frames.
+ *                     The first frame starts with a reference count
+ *                     of 1. Returns 0 if no large enough block is free.
+ *
+ * coremap_free      - free an allocation made by coremap_alloc, given
+ *                     the address of its first frame.
+ *
+ * coremap_incref    - add a reference to a single-page allocation.
+ *
+ * coremap_decref    - drop a reference to a single-page allocation,
+ *                     freeing it when the last one goes. Returns the
+ *                     number of references left.
+ *
+ * coremap_refcount  - current reference count of a frame.
+ *
+ * coremap_nframes   - number of frames managed.
+ *
+ * coremap_freeframes - number of frames on the free lists (not
+ *                     counting the per-CPU caches). Unlocked, so only
+ *                     a hint.
+ *
+ * coremap_touch     - note that AS has just mapped the user page at
+ *                     PADDR at VADDR. If AS is its only user, the page
+ *                     becomes a candidate for eviction.
+ *
+ * coremap_setfile   - record that PADDR holds the page at OFFSET of the
+ *                     file cached in FM (NULL once it doesn't), which
+ *                     makes it a candidate for eviction.
+ *
+ * coremap_setkmpage - record KP as kmalloc's descriptor for the kernel
+ *                     page at PADDR (NULL when it gives the page up).
+ *                     Frames not managed here are ignored.
+ *
+ * coremap_kmpage    - return the descriptor recorded for the page
+ *                     PADDR is on, or NULL. Sets *MANAGED to whether
+ *                     that is a frame managed here at all.
+ *
+ * coremap_deactivate - clear the referenced bit of the user page at
+ *                     PADDR, so the clock takes it the first time it
+ *                     comes round.
+ *
+ * coremap_clock     - advance the clock hand to the next page that can
+ *                     be evicted, mark it busy and return it, with its
+ *                     owner, or its file cache and offset (*FM is NULL
+ *                     if it has an owner), and whether it was
+ *                     referenced since the last sweep (which also
+ *                     clears that). Returns 0 if there is no such page.
+ *
+ * coremap_unbusy    - hand back a page returned by coremap_clock. If
+ *                     EVICTED is set, its owner no longer maps it.
+ *
+ * coremap_setslot   - record that swap slot SLOT holds an up to date
+ *                     copy of the private page at PADDR.
+ *
+ * coremap_takeslot  - return and forget that slot, or SWAP_NOSLOT.
+ *
+ * coremap_printstats - print free memory by block size and a
+ *                     fragmentation summary.
+ *
+ * pagecache_tune    - set the per-CPU cache high watermark and batch
+ *                     size. Returns EINVAL if they don't fit the cache.
+ *
+ * pagecache_printstats - print the per-CPU cache watermarks and each
+ *                     CPU's hit, refill and drain counters.
+ */
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+void coremap_free(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+unsigned coremap_decref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+unsigned coremap_nframes(void);
+unsigned coremap_freeframes(void);
+void coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+void coremap_setkmpage(paddr_t paddr, void *kp);
+void *coremap_kmpage(paddr_t paddr, bool *managed);
+void coremap_deactivate(paddr_t paddr);
+void coremap_setfile(paddr_t paddr, struct filemap *fm, off_t offset);
+paddr_t coremap_clock(struct addrspace **as, vaddr_t *vaddr,
+		      struct filemap **fm, off_t *offset, bool *referenced);
+void coremap_unbusy(paddr_t paddr, bool evicted);
+void coremap_setslot(paddr_t paddr, unsigned slot);
+unsigned coremap_takeslot(paddr_t paddr);
+void coremap_printstats(void);
+int pagecache_tune(unsigned high, unsigned batch);
+void pagecache_printstats(void);
+
+#endif /* _COREMAP_H_ */
@@ -34,6 +34,7 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-A3.h"
 
 
 /*
@@ -152,6 +153,9 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch sends several mappings with a single IPI.
+ * ipi_tlbshootdown_wait waits for a CPU to finish its shootdowns, after
+ * which it no longer has the mappings sent to it.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -166,6 +170,16 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+#if OPT_A3
+void ipi_tlbshootdown_batch(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned n);
+void ipi_tlbshootdown_wait(struct cpu *target);
+
+/*
+ * Look up a CPU by its number (c_number).
+ */
+struct cpu *cpu_bynumber(unsigned num);
+#endif
 
 void interprocessor_interrupt(void);
 
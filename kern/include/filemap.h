@@ -0,0 +1,79 @@
+#ifndef _FILEMAP_H_
+#define _FILEMAP_H_
+
+/*
+ * Per-vnode page cache for mapped files and shared text.
+ *
+ * Every vnode that is mapped into some address space has one filemap,
+ * shared by all its mappings. It holds the frames of the pages of the
+ * file read in so far, keyed by file offset (in a struct pagetable,
+ * since offsets of mapped files fit in the user address range). The
+ * filemap keeps one reference to each frame and every PTE mapping it
+ * holds another, so frames are shared between processes.
+ *
+ * Executables use the same cache for their text pages, which is how
+ * processes running the same program share them.
+ *
+ * The filemap also knows every region mapping it, so the pager can
+ * evict its pages like any other: filemap_evict takes the page out of
+ * each mapping (see as_unmapfile), writes it back if it was written,
+ * and frees it. The next touch reads it in again. What's left of the
+ * cache goes when the last mapping of the vnode does.
+ *
+ * Otherwise the filemap doesn't know which pages have been written;
+ * address spaces track that in their own PTEs (PTE_MODIFIED) and
+ * write pages back with filemap_writeback on msync and munmap.
+ */
+
+#include <vm.h>
+
+struct vnode;
+struct addrspace;
+struct region;
+struct filemap;
+
+/*
+ * filemap_bootstrap - set up the table of filemaps. Called once from
+ *                     vm_bootstrap.
+ *
+ * filemap_get       - return the filemap of V, creating it if need be,
+ *                     and add RG in AS to its mappings. Returns NULL
+ *                     if out of memory.
+ *
+ * filemap_addmap    - add RG in AS to the mappings of FM.
+ *
+ * filemap_put       - take RG out of the mappings. The last one frees
+ *                     the cached frames, writing back any written
+ *                     pages no longer mapped, and releases the vnode.
+ *                     RG's address space must still be in one piece.
+ *
+ * filemap_getpage   - store in *PADDR the frame holding the page of the
+ *                     file at OFFSET, reading it in (and setting
+ *                     *FROMDISK) if it isn't cached. The caller gets a
+ *                     reference to the frame. Bytes past EOF read as 0.
+ *
+ * filemap_writeback - write the cached page at OFFSET back to the file,
+ *                     up to EOF. Does nothing if it isn't cached.
+ *
+ * filemap_evict     - for the pager: evict the cached page at OFFSET,
+ *                     in frame PADDR, which coremap_clock returned and
+ *                     this hands back. Returns true if the frame was
+ *                     freed; false if someone else had a lock we need,
+ *                     or the page was in use.
+ *
+ * filemap_printstats - print the number of filemaps and pages cached
+ *                     and hit, miss and writeback counts.
+ */
+void filemap_bootstrap(void);
+struct filemap *filemap_get(struct vnode *v, struct addrspace *as,
+			    struct region *rg);
+int filemap_addmap(struct filemap *fm, struct addrspace *as,
+		   struct region *rg);
+void filemap_put(struct filemap *fm, struct region *rg);
+int filemap_getpage(struct filemap *fm, off_t offset, paddr_t *paddr,
+		    bool *fromdisk);
+int filemap_writeback(struct filemap *fm, off_t offset);
+bool filemap_evict(struct filemap *fm, off_t offset, paddr_t paddr);
+void filemap_printstats(void);
+
+#endif /* _FILEMAP_H_ */
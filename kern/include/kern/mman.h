@@ -0,0 +1,36 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap(), munmap(), msync() and madvise().
+ */
+
+/* Protection bits for mmap(). */
+#define PROT_NONE      0
+#define PROT_READ      1
+#define PROT_WRITE     2
+#define PROT_EXEC      4
+
+/* Sharing flags for mmap(); exactly one must be given. */
+#define MAP_SHARED     1	/* writes go to the file */
+#define MAP_PRIVATE    2	/* writes go to a private copy */
+
+/* Flags for msync(). Writeback is always synchronous. */
+#define MS_SYNC        1
+#define MS_ASYNC       2
+#define MS_INVALIDATE  4
+
+/*
+ * Advice for madvise(). The first three describe how a region will be
+ * used and last until changed; the other two act on the pages at once:
+ * WILLNEED brings them in, and DONTNEED throws them away, so the next
+ * use finds them as if never touched (shared mappings are written back
+ * first).
+ */
+#define MADV_NORMAL      0
+#define MADV_RANDOM      1
+#define MADV_SEQUENTIAL  2
+#define MADV_WILLNEED    3
+#define MADV_DONTNEED    4
+
+#endif /* _KERN_MMAN_H_ */
@@ -89,4 +89,17 @@ struct rlimit {
 
 #define RLIM_INFINITY	(~(__rlim_t)0)
 
+/*
+ * Memory use of a process, for getmemusage(). Sizes are in pages.
+ * The peak and the fault counts cover the life of the process; the
+ * rest describe its current address space.
+ */
+struct memusage {
+	__u32 mu_rss;		/* resident pages */
+	__u32 mu_peakrss;	/* most ever resident */
+	__u32 mu_wss;		/* pages used in the last sample interval */
+	__u32 mu_faults;	/* page faults taken */
+	__u32 mu_majfaults;	/* those that had to read from disk */
+};
+
 #endif /* _KERN_RESOURCE_H_ */
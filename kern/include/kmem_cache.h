@@ -0,0 +1,54 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches.
+ *
+ * A cache hands out objects of one size, taken from kmalloc. An
+ * optional constructor sets up the parts of an object that survive
+ * between uses (locks, lists, buffers), and objects go back on the
+ * cache still in that state, so the next allocation skips both kmalloc
+ * and the constructor. Each cache keeps only a few free objects; past
+ * that, and when kmalloc runs out of memory, they are destroyed and
+ * freed.
+ */
+
+#define KMC_MAXFREE    32       /* most free objects a cache keeps */
+#define KMC_FREEBYTES  16384    /* ...and most bytes of them, but */
+#define KMC_MINFREE    2        /* always at least this many */
+
+struct kmem_cache;
+
+/*
+ * kmem_cache_create  - make a cache of SIZE-byte objects. NAME is not
+ *                      copied. CTOR, if not NULL, is called on each
+ *                      new object and returns an error code; it may
+ *                      sleep. DTOR, if not NULL, undoes it before the
+ *                      object is freed; it may be called from inside
+ *                      kmalloc, so it must not sleep or allocate.
+ *                      Returns NULL if out of memory.
+ *
+ * kmem_cache_destroy - free every object cached by KC, and KC. All of
+ *                      its objects must have been freed.
+ *
+ * kmem_cache_alloc   - get a constructed object, or NULL.
+ *
+ * kmem_cache_free    - give back OBJ, which must be in the state the
+ *                      constructor left it in.
+ *
+ * kmem_cache_reap    - destroy every free object in every cache.
+ *                      Returns how many. Called by kmalloc when it
+ *                      runs out of memory.
+ *
+ * kmem_cache_printstats - print each cache's counters.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+unsigned kmem_cache_reap(void);
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
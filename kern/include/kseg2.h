@@ -0,0 +1,65 @@
+#ifndef _KSEG2_H_
+#define _KSEG2_H_
+
+/*
+ * Kernel virtual memory in kseg2.
+ *
+ * Multi-page kernel allocations normally come from the coremap as
+ * physically contiguous blocks in kseg0, which needs no TLB entries.
+ * Once memory is fragmented such blocks may not exist even with
+ * plenty of single frames free, so alloc_kpages falls back to this:
+ * frames are allocated one at a time and mapped at consecutive pages
+ * of a window at the bottom of kseg2.
+ *
+ * The kernel's PTEs for the window are a flat array, allocated at
+ * boot, so a kernel TLB miss there (which comes through vm_fault like
+ * any other) is handled without locks or allocation. The entries are
+ * global, so they match whatever ASID is current. Every allocation is
+ * followed by an unmapped guard page, so running off the end faults.
+ *
+ * Any CPU may have such an entry in its TLB, so freed pages can only
+ * be reused after a shootdown on every CPU. Frees are made lazily:
+ * the pages are unmapped at once, so any later use faults, but their
+ * frames and addresses are kept until enough have piled up (or an
+ * allocation runs short), and then all of them are released after a
+ * single TLB flush everywhere.
+ *
+ * Nothing that can be touched while taking an exception may live
+ * here; in particular not thread stacks, which are a single page and
+ * so never do.
+ */
+
+#include <vm.h>
+
+/* Size of the window (16M). */
+#define KSEG2_PAGES         4096
+
+/* Freed pages held back before they are all released together. */
+#define KSEG2_PURGE_PAGES   64
+
+/*
+ * kseg2_bootstrap   - allocate the page table and address map. Called
+ *                     from vm_bootstrap once the coremap is up.
+ *
+ * kseg2_alloc       - allocate NPAGES separate frames and map them at
+ *                     consecutive addresses. Returns 0 if out of frames
+ *                     or addresses.
+ *
+ * kseg2_free        - free an allocation made by kseg2_alloc, given
+ *                     its address.
+ *
+ * kseg2_owns        - true if VADDR is in the window.
+ *
+ * kseg2_fault       - load the TLB entry for kernel address VADDR.
+ *                     Returns EFAULT if it is not mapped.
+ *
+ * kseg2_printstats  - print how much of the window is in use.
+ */
+void kseg2_bootstrap(void);
+vaddr_t kseg2_alloc(unsigned npages);
+void kseg2_free(vaddr_t vaddr);
+bool kseg2_owns(vaddr_t vaddr);
+int kseg2_fault(vaddr_t vaddr);
+void kseg2_printstats(void);
+
+#endif /* _KSEG2_H_ */
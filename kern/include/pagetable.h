@@ -0,0 +1,77 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for user address spaces.
+ *
+ * A user virtual page number splits into a directory index (top 9
+ * bits, since kuseg is only 2G) and a table index (next 10 bits). Each
+ * second-level table is one page of PTEs covering 4M of address space,
+ * and is only allocated once a page in that range is touched.
+ *
+ * A PTE uses the same layout as the TLB EntryLo word, so the frame
+ * and the hardware bits of a resident page can be loaded into the TLB
+ * unchanged; the UTLB refill handler in exception-mips1.S does just
+ * that, without calling vm_fault. So PTE_DIRTY must only be set when a
+ * writable mapping is allowed: the page is private, modified, and in a
+ * writeable region. The low byte, which EntryLo ignores, holds
+ * software state. A PTE of 0 means the page has never been touched (or was
+ * never written and has since been dropped). A page that has been
+ * paged out has PTE_SWAPPED set and its swap slot in place of the
+ * frame number.
+ *
+ * PTE_REF is set by vm_fault whenever it loads a page into the TLB and
+ * cleared by the working-set sampler, which also drops the TLB entry.
+ * The refill handler only loads PTEs with the bit set, so the first
+ * use of a page since the last sample comes through vm_fault and sets
+ * it again. It is only ever set together with PTE_VALID.
+ */
+
+#include <vm.h>
+#include <mips/tlb.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME      TLBLO_PPAGE   /* physical frame of a resident page */
+#define PTE_VALID      TLBLO_VALID   /* page is resident in PTE_FRAME */
+#define PTE_DIRTY      TLBLO_DIRTY   /* may be mapped writable */
+#define PTE_COW        0x00000001    /* frame is shared; copy before writing */
+#define PTE_MODIFIED   0x00000002    /* written since last paged in */
+#define PTE_SWAPPED    0x00000004    /* not resident; PTE_SLOT is in swap */
+#define PTE_REF        0x00000008    /* used since the last WSS sample */
+
+#define PTE_SLOT(pte)   ((pte) >> 12)
+#define PTE_SWAP(slot)  (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+#define PT_TABLE_ENTRIES  (PAGE_SIZE / sizeof(pte_t))
+#define PT_TABLE_SPAN     (PT_TABLE_ENTRIES * PAGE_SIZE)
+#define PT_DIR_ENTRIES    (USERSPACETOP / PT_TABLE_SPAN)
+
+#define PT_DIR_INDEX(va)    ((va) / PT_TABLE_SPAN)
+#define PT_TABLE_INDEX(va)  (((va) / PAGE_SIZE) % PT_TABLE_ENTRIES)
+
+struct pagetable {
+	pte_t *pt_dir[PT_DIR_ENTRIES];	/* second-level tables, or NULL */
+};
+
+/*
+ * pt_create  - allocate an empty page table. Returns NULL if out of
+ *              memory.
+ *
+ * pt_destroy - free the page table and its second-level tables. The
+ *              caller is responsible for the frames the PTEs refer to.
+ *
+ * pt_lookup  - return the PTE for user address VADDR. If its table
+ *              does not exist yet and CREATE is set, allocate it;
+ *              otherwise (or if out of memory) return NULL.
+ *
+ * pt_next    - return the first non-zero PTE at or above *VADDR and
+ *              store its address back in *VADDR, or return NULL if
+ *              there is none. Unallocated tables are skipped whole.
+ */
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+pte_t *pt_next(struct pagetable *pt, vaddr_t *vaddr);
+
+#endif /* _PAGETABLE_H_ */
@@ -39,6 +39,7 @@
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 #define PROC_EXITED 0
@@ -87,6 +88,12 @@ struct proc {
 	int p_state;
 	int p_exitcode;
 #endif
+#if OPT_A3
+	/* Memory use over its lifetime; only updated by its own thread. */
+	unsigned p_faults;		/* page faults taken */
+	unsigned p_majfaults;		/* those that read from disk */
+	unsigned p_peakrss;		/* most pages ever resident */
+#endif
 };
 
 #if OPT_A2
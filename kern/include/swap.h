@@ -0,0 +1,47 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Evicted user pages are written to a dedicated disk, the raw device
+ * of the second LAMEbus disk, one page per slot. Free slots are tracked
+ * in a bitmap. If the disk isn't there the system runs without paging.
+ *
+ * Pages are written out in clusters: the pager collects up to
+ * SWAP_CLUSTER dirty victims and, if it can find that many adjacent
+ * free slots, writes them to disk with a single VOP_WRITE.
+ */
+
+#include <vm.h>
+
+#define SWAP_DEVICE   "lhd1raw:"
+#define SWAP_CLUSTER  8         /* most pages written in one go */
+#define SWAP_NOSLOT   ((unsigned)-1)
+
+/*
+ * swap_bootstrap - open the swap device. Called once from vm_bootstrap.
+ *
+ * swap_enabled   - true if there is a swap device.
+ *
+ * swap_alloc     - reserve NSLOTS adjacent slots and store the first in
+ *                  *SLOT. Returns ENOSPC if there is no such run.
+ *
+ * swap_free      - release one slot.
+ *
+ * swap_read      - read slot SLOT into the frame at PADDR.
+ *
+ * swap_write     - write the NPAGES frames in PADDRS to the slots
+ *                  starting at SLOT, in one I/O.
+ *
+ * swap_printstats - print swap usage.
+ */
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_alloc(unsigned nslots, unsigned *slot);
+void swap_free(unsigned slot);
+int swap_read(unsigned slot, paddr_t paddr);
+int swap_write(unsigned slot, const paddr_t *paddrs, unsigned npages);
+void swap_printstats(void);
+
+#endif /* _SWAP_H_ */
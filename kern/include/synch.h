@@ -89,6 +89,8 @@ void lock_acquire(struct lock *);
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
  *                   same time.
+ *    lock_tryacquire - Get the lock if it is free, without sleeping.
+ *                   Returns true if the lock was taken.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock; 
@@ -96,6 +98,7 @@ void lock_acquire(struct lock *);
  *
  * These operations must be atomic. You get to write them.
  */
+bool lock_tryacquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
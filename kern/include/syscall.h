@@ -81,4 +81,13 @@ int sys_fork(struct trapframe *ptf, pid_t *retval);
 int sys_execv(const userptr_t program, userptr_t args);
 #endif
 
+#if OPT_A3
+int sys_sbrk(intptr_t amount, vaddr_t *retval);
+int sys_mmap(userptr_t path, size_t len, int prot, int flags, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_getmemusage(pid_t pid, userptr_t usage);
+#endif
+
 #endif /* _SYSCALL_H_ */
@@ -18,8 +18,14 @@
  *
  * Generally you will use the functions whose names
  * do not begin with '_'.
+ *
+ * With OPT_A3 there is no stats_lock: each CPU counts in its own set
+ * of counters, and the sets are added up when they are read. The '_'
+ * functions then expect to be called at splhigh instead.
  */
 
+#include "opt-A3.h"
+
 
 /* These are the different stats that get tracked.
  * See vmstats.c for strings corresponding to each stat.
@@ -36,7 +42,27 @@
 #define VMSTAT_ELF_FILE_READ          (7)
 #define VMSTAT_SWAP_FILE_READ         (8)
 #define VMSTAT_SWAP_FILE_WRITE        (9)
+#if OPT_A3
+/* Faults (of any kind) by the type of region they hit */
+#define VMSTAT_FAULT_TEXT            (10)
+#define VMSTAT_FAULT_DATA            (11)
+#define VMSTAT_FAULT_HEAP            (12)
+#define VMSTAT_FAULT_STACK           (13)
+#define VMSTAT_FAULT_MMAP            (14)
+#define VMSTAT_COW_COPY              (15)
+#define VMSTAT_COW_REUSE             (16)
+#define VMSTAT_EVICT_CLEAN           (17)
+#define VMSTAT_EVICT_DIRTY           (18)
+/* Pages loaded by fault-around, and how many of those were used */
+#define VMSTAT_FAULTAROUND_LOAD      (19)
+#define VMSTAT_FAULTAROUND_HIT       (20)
+/* Pages brought in by WILLNEED or read-ahead, and dropped by DONTNEED */
+#define VMSTAT_PREFETCH              (21)
+#define VMSTAT_DONTNEED              (22)
+#define VMSTAT_COUNT                 (23)
+#else
 #define VMSTAT_COUNT                 (10)
+#endif
 
 /* ----------------------------------------------------------------------- */
 
@@ -55,4 +81,12 @@ void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
 
+#if OPT_A3
+/* Add up every CPU's counters into COUNTS, which has VMSTAT_COUNT entries */
+void vmstats_snapshot(unsigned int *counts);       /* Does NOT use locking */
+
+/* Print snapshot AFTER, and how much each counter changed since BEFORE */
+void vmstats_printdelta(const unsigned int *before, const unsigned int *after);
+#endif
+
 #endif /* VM_STATS_H */
@@ -38,6 +38,7 @@
 
 
 #include <machine/vm.h>
+#include "opt-A3.h"
 
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
@@ -55,9 +56,42 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+#if OPT_A3
+/* Allocate a zeroed frame for user data, paging out if need be. */
+paddr_t alloc_upage(void);
+
+/*
+ * Set or get the largest fault-around window, in pages (0 for none).
+ * vm_setfaultaround returns EINVAL above FAULTAROUND_LIMIT.
+ */
+int vm_setfaultaround(unsigned maxpages);
+unsigned vm_faultaround(void);
+
+/*
+ * Turn the per-CPU kmalloc magazines on or off (off drains them), and
+ * print their counters and how often kmalloc's lock was taken, then
+ * reset the counters.
+ */
+void kmalloc_setmagazines(bool on);
+void kmalloc_printmagstats(void);
+
+/*
+ * Turn the kmalloc allocation profiler on, starting a new run, or off
+ * (keeping the run's totals); and print its report: top callers, size
+ * and rate histograms, and callers with blocks still live. Turning it
+ * on returns ENOMEM if there's no room for its table.
+ */
+int kmalloc_setprofiling(bool on);
+void kmalloc_printprofile(void);
+#endif
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
+#if OPT_A3
+/* Print each CPU's shootdown counters. */
+void vm_tlbshootdown_printstats(void);
+#endif
 
 
 #endif /* _VM_H_ */
@@ -0,0 +1,67 @@
+#ifndef _VMTLB_H_
+#define _VMTLB_H_
+
+/*
+ * TLB slot management.
+ *
+ * Each CPU keeps a shadow of what the VM system has loaded into its
+ * TLB: the EntryHi of every slot in use, a referenced bit, and a stack
+ * of free slots, so a free slot is found in O(1) instead of by reading
+ * back the whole TLB. When none is free a victim is chosen by the
+ * current replacement policy:
+ *
+ *   random - let the hardware pick (tlbwr), as the UTLB refill
+ *            handler does.
+ *   fifo   - evict slots round-robin, oldest first.
+ *   clock  - second chance. Loading an entry marks it referenced. The
+ *            hand clears the bit of a referenced slot and also
+ *            invalidates the hardware entry, leaving the tag in place,
+ *            so the next use faults to vm_fault, reloads the same slot
+ *            and sets the bit again. Slots not used since the hand
+ *            last passed are evicted.
+ *
+ * The refill handler in exception-mips1.S writes the TLB behind our
+ * back, so it is only enabled under the random policy (see
+ * as_activate); with the others every miss goes through vm_fault.
+ * Under random the shadow is only a hint, which is all it is used for:
+ * entries are always found with tlb_probe.
+ *
+ * Everything here works on the current CPU's TLB.
+ */
+
+#define TLBPOLICY_RANDOM  0
+#define TLBPOLICY_FIFO    1
+#define TLBPOLICY_CLOCK   2
+
+/*
+ * vmtlb_bootstrap  - clear every CPU's shadow. Called once from
+ *                    vm_bootstrap.
+ *
+ * vmtlb_flush      - invalidate the whole TLB.
+ *
+ * vmtlb_drop       - invalidate the entry matching EHI, if any, and
+ *                    return whether there was one.
+ *
+ * vmtlb_load       - load EHI/ELO into the TLB, over the entry for the
+ *                    same page if there is one, otherwise into a free
+ *                    slot or a victim's. Returns true if a valid entry
+ *                    was evicted.
+ *
+ * vmtlb_setpolicy  - select a policy by name. Returns EINVAL if there
+ *                    is no such policy. Every CPU's TLB is flushed
+ *                    before it returns, and the refill handler is
+ *                    turned off if the new policy can't use it.
+ *
+ * vmtlb_fastrefill - true if the UTLB refill handler may be used.
+ *
+ * vmtlb_printstats - print the policy and each CPU's slot counters.
+ */
+void vmtlb_bootstrap(void);
+void vmtlb_flush(void);
+bool vmtlb_drop(uint32_t ehi);
+bool vmtlb_load(uint32_t ehi, uint32_t elo);
+int vmtlb_setpolicy(const char *name);
+bool vmtlb_fastrefill(void);
+void vmtlb_printstats(void);
+
+#endif /* _VMTLB_H_ */
@@ -0,0 +1,39 @@
+#ifndef _ZEROPOOL_H_
+#define _ZEROPOOL_H_
+
+/*
+ * Pool of pre-zeroed frames.
+ *
+ * A kernel thread zeroes free frames into a small pool whenever its
+ * CPU has nothing else to run, so zero-fill page faults can usually
+ * take a ready page instead of clearing one on the spot. The thread
+ * leaves memory alone when free frames are scarce, and the pool is the
+ * first thing given back when an allocation fails.
+ */
+
+#include <vm.h>
+
+#define ZEROPOOL_SIZE  64       /* most frames kept zeroed */
+
+/*
+ * zeropool_bootstrap - start the zeroing thread. Called once from
+ *                      vm_bootstrap.
+ *
+ * zeropool_get       - take a zeroed frame with one reference, or
+ *                      return 0 if the pool is empty.
+ *
+ * zeropool_zero      - zero the frame at PADDR now, for a caller
+ *                      that missed in the pool.
+ *
+ * zeropool_drain     - free every frame in the pool. Returns how many.
+ *
+ * zeropool_printstats - print hit and miss counts and the time spent
+ *                      zeroing, in the thread and on demand.
+ */
+void zeropool_bootstrap(void);
+paddr_t zeropool_get(void);
+void zeropool_zero(paddr_t paddr);
+unsigned zeropool_drain(void);
+void zeropool_printstats(void);
+
+#endif /* _ZEROPOOL_H_ */
@@ -51,11 +51,15 @@
 #include <synch.h>
 #include <kern/fcntl.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 #if OPT_A2
 #include <array.h>
 #include <limits.h>
 #endif
+#if OPT_A3
+#include <kmem_cache.h>
+#endif
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -103,6 +107,35 @@ pid_t pid_gen(void) {
 }
 #endif
 
+#if OPT_A3
+static struct kmem_cache *proc_cache;
+
+/*
+ * Cached procs keep p_lock and their (empty) thread array set up, so
+ * the array also keeps the storage it grew on earlier uses.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+}
+#endif
+
 /*
  * Create a proc structure.
  */
@@ -112,18 +145,30 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
+#if OPT_A3
+	proc = kmem_cache_alloc(proc_cache);
+#else
 	proc = kmalloc(sizeof(*proc));
+#endif
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
+#if OPT_A3
+		kmem_cache_free(proc_cache, proc);
+#else
 		kfree(proc);
+#endif
 		return NULL;
 	}
 
+#if OPT_A3
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+#else
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+#endif
 
 #if OPT_A2
 	proc->p_id = PROC_NULL_PID;
@@ -131,6 +176,11 @@ proc_create(const char *name)
 	proc->p_state = PROC_RUNNING;
 	proc->p_exitcode = 0;
 #endif
+#if OPT_A3
+	proc->p_faults = 0;
+	proc->p_majfaults = 0;
+	proc->p_peakrss = 0;
+#endif
 
 	/* VM fields */
 	proc->p_addrspace = NULL;
@@ -202,11 +252,16 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
+#if OPT_A3
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
+	kfree(proc->p_name);
+#else
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
 	kfree(proc);
+#endif
 
 #if OPT_A2
 	if (proc->p_id != PROC_NULL_PID) {
@@ -217,6 +272,11 @@ proc_destroy(struct proc *proc)
 	proc->p_state = PROC_UNUSED_PID;
 #endif // OPT_A2
 
+#if OPT_A3
+	/* Only now: the code above still looks at it. */
+	kmem_cache_free(proc_cache, proc);
+#endif
+
 #ifdef UW
 	/* decrement the process count */
         /* note: kproc is not included in the process count, but proc_destroy
@@ -241,6 +301,13 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+#if OPT_A3
+  proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				 proc_ctor, proc_dtor);
+  if (proc_cache == NULL) {
+    panic("proc_bootstrap: could not create proc cache\n");
+  }
+#endif
   kproc = proc_create("[kernel]");
   if (kproc == NULL) {
     panic("proc_bootstrap: proc_create for kproc failed\n");
@@ -46,6 +46,19 @@
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <addrspace.h>
+#include <coremap.h>
+#include <swap.h>
+#include <zeropool.h>
+#include <vmtlb.h>
+#include <filemap.h>
+#include <kseg2.h>
+#include <kmem_cache.h>
+#include <uw-vmstats.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -416,10 +429,209 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if OPT_A3
+	pagecache_printstats();
+	kseg2_printstats();
+#endif
 	
 	return 0;
 }
 
+#if OPT_A3
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+	zeropool_printstats();
+	swap_printstats();
+	filemap_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_pagecachetune(int nargs, char **args)
+{
+	if (nargs != 3) {
+		kprintf("Usage: pcw high-watermark batch\n");
+		return EINVAL;
+	}
+
+	return pagecache_tune(atoi(args[1]), atoi(args[2]));
+}
+
+static
+int
+cmd_tlbpolicy(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: tlb [random|fifo|clock]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		result = vmtlb_setpolicy(args[1]);
+		if (result) {
+			kprintf("tlb: unknown policy %s\n", args[1]);
+			return result;
+		}
+	}
+	vmtlb_printstats();
+	vm_tlbshootdown_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for setting the largest fault-around window.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	int result;
+
+	if (nargs > 2) {
+		kprintf("Usage: fa [maxpages]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		result = vm_setfaultaround(atoi(args[1]));
+		if (result) {
+			kprintf("fa: at most %u pages\n", FAULTAROUND_LIMIT);
+			return result;
+		}
+	}
+	kprintf("Fault-around window: up to %u pages%s\n", vm_faultaround(),
+		vmtlb_fastrefill() ? " (off while the refill handler is on)" : "");
+
+	return 0;
+}
+
+/*
+ * Command for printing the VM counters, with how much each has
+ * changed since the last time.
+ */
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	static unsigned int last[VMSTAT_COUNT];
+	unsigned int now[VMSTAT_COUNT];
+
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: vmstat\n");
+		return EINVAL;
+	}
+	vmstats_snapshot(now);
+	vmstats_printdelta(last, now);
+	memcpy(last, now, sizeof(now));
+
+	return 0;
+}
+
+/*
+ * Command for turning the kmalloc magazines on or off, and printing
+ * their counters.
+ */
+static
+int
+cmd_kmag(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: kmag [on|off]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "on")) {
+			kmalloc_setmagazines(true);
+		}
+		else if (!strcmp(args[1], "off")) {
+			kmalloc_setmagazines(false);
+		}
+		else {
+			kprintf("Usage: kmag [on|off]\n");
+			return EINVAL;
+		}
+	}
+	kmalloc_printmagstats();
+
+	return 0;
+}
+
+/*
+ * Command for running the kmalloc profiler and printing its report.
+ */
+static
+int
+cmd_kprof(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: kprof [on|off]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		if (!strcmp(args[1], "on")) {
+			return kmalloc_setprofiling(true);
+		}
+		else if (!strcmp(args[1], "off")) {
+			kmalloc_setprofiling(false);
+		}
+		else {
+			kprintf("Usage: kprof [on|off]\n");
+			return EINVAL;
+		}
+	}
+	kmalloc_printprofile();
+
+	return 0;
+}
+
+/*
+ * Command for printing the kernel object caches' counters.
+ */
+static
+int
+cmd_kmemcache(int nargs, char **args)
+{
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: kc\n");
+		return EINVAL;
+	}
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing each process's memory use.
+ */
+static
+int
+cmd_memusage(int nargs, char **args)
+{
+	(void)args;
+
+	if (nargs != 1) {
+		kprintf("Usage: mem\n");
+		return EINVAL;
+	}
+	as_printusage();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -530,6 +742,17 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+#if OPT_A3
+	"[cm] Physical memory and swap stats ",
+	"[pcw] Per-CPU page cache watermarks ",
+	"[tlb] TLB replacement policy        ",
+	"[fa] Fault-around window            ",
+	"[vmstat] VM counters and deltas     ",
+	"[mem] Per-process memory usage      ",
+	"[kmag] kmalloc per-CPU magazines    ",
+	"[kc] Kernel object caches           ",
+	"[kprof] kmalloc profiler            ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -587,6 +810,17 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+#if OPT_A3
+	{ "cm",         cmd_coremapstats },
+	{ "pcw",        cmd_pagecachetune },
+	{ "tlb",        cmd_tlbpolicy },
+	{ "fa",         cmd_faultaround },
+	{ "vmstat",     cmd_vmstat },
+	{ "mem",        cmd_memusage },
+	{ "kmag",       cmd_kmag },
+	{ "kc",         cmd_kmemcache },
+	{ "kprof",      cmd_kprof },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
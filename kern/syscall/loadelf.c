@@ -62,6 +62,7 @@
 
 #include "opt-A3.h"
 
+#if !OPT_A3
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
@@ -146,6 +147,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	
 	return result;
 }
+#endif /* !OPT_A3 */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -261,7 +263,9 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Now actually load each segment. With OPT_A3 nothing is read
+	 * here: the VM system is told where each segment is in the file
+	 * and pages it in as it is touched.
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
@@ -290,9 +294,19 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+#if OPT_A3
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
+
+		result = as_define_file(as, ph.p_vaddr, v, ph.p_offset,
+					ph.p_filesz);
+#else
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
+#endif
 		if (result) {
 			return result;
 		}
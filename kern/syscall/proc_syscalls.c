@@ -201,6 +201,16 @@ int sys_fork(struct trapframe *ptf, pid_t *retval) {
 
 
   // Create and copy address space (and data) from parent to child
+#if OPT_A3
+  /* as_copy creates the child's address space, sharing pages copy-on-write */
+  struct addrspace *childAddrs;
+  result = as_copy(parentProc->p_addrspace, &childAddrs);
+  if (result) {
+    DEBUG(DB_SYSCALL, "sys_fork: Failed to copy addrspace to new process.\n");
+    proc_destroy(childProc);
+    return ENOMEM;
+  }
+#else
   struct addrspace *childAddrs = as_create();
   if (childAddrs == NULL) {
     DEBUG(DB_SYSCALL, "sys_fork: Failed to create addrspace for new process.\n");
@@ -215,6 +225,7 @@ int sys_fork(struct trapframe *ptf, pid_t *retval) {
     as_destroy(childAddrs);
     return ENOMEM;
   }
+#endif
 
   // Attach the newly created address space to the child process structure
   spinlock_acquire(&childProc->p_lock);
@@ -398,7 +409,12 @@ int sys_execv(const userptr_t program, userptr_t args) {
     }
   }
 
+#if OPT_A3
+  /* the old image's pages go back to the coremap */
+  as_destroy(oldas);
+#else
   kfree(oldas);
+#endif
 
   enter_new_process(num, (userptr_t)stackptr, stackptr, entrypoint);
   /* enter_new_process does not return. */
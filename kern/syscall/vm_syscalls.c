@@ -0,0 +1,156 @@
+/*
+ * Memory management system calls (A3).
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <limits.h>
+#include <lib.h>
+#include <proc.h>
+#include <current.h>
+#include <copyinout.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <addrspace.h>
+#include <syscall.h>
+
+/*
+ * sbrk: move the end of the heap by AMOUNT bytes and return the old
+ * end. The address space does the work; see as_sbrk.
+ */
+int
+sys_sbrk(intptr_t amount, vaddr_t *retval)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_sbrk(as, amount, retval);
+}
+
+/*
+ * mmap: map the first LEN bytes of the file at PATH and return where.
+ *
+ * There are no file descriptors in this kernel, so the file is named
+ * by path instead, and mapped from its start. The address is always
+ * the kernel's choice.
+ */
+int
+sys_mmap(userptr_t path, size_t len, int prot, int flags, vaddr_t *retval)
+{
+	struct addrspace *as;
+	struct vnode *v;
+	char *kpath;
+	bool shared;
+	int result;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) {
+		return EINVAL;
+	}
+	if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+		return EINVAL;
+	}
+	shared = flags == MAP_SHARED;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+	/* Only a shared writable mapping writes to the file. */
+	result = vfs_open(kpath, shared && (prot & PROT_WRITE) ?
+			  O_RDWR : O_RDONLY, 0, &v);
+	kfree(kpath);
+	if (result) {
+		return result;
+	}
+
+	result = VOP_MMAP(v);
+	if (result == 0) {
+		result = as_mmap(as, v, len, prot & PROT_READ,
+				 prot & PROT_WRITE, prot & PROT_EXEC,
+				 shared, retval);
+	}
+	/* The mapping keeps its own reference. */
+	vfs_close(v);
+	return result;
+}
+
+/* munmap: remove the mapping at ADDR. See as_munmap. */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/* msync: write back shared mappings in a range. See as_msync. */
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+	struct addrspace *as;
+
+	if (flags & ~(MS_SYNC | MS_ASYNC | MS_INVALIDATE)) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_msync(as, (vaddr_t)addr, len);
+}
+
+/* madvise: describe how a range will be used. See as_madvise. */
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+	struct addrspace *as;
+
+	if (advice < MADV_NORMAL || advice > MADV_DONTNEED) {
+		return EINVAL;
+	}
+	as = curproc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	return as_madvise(as, (vaddr_t)addr, len, advice);
+}
+
+/*
+ * getmemusage: report the memory use of process PID, or of the caller
+ * if PID is 0. See as_getusage.
+ */
+int
+sys_getmemusage(pid_t pid, userptr_t usage)
+{
+	struct memusage mu;
+	int result;
+
+	if (pid == 0) {
+		pid = curproc->p_id;
+	}
+	result = as_getusage(pid, &mu);
+	if (result) {
+		return result;
+	}
+	return copyout(&mu, usage, sizeof(mu));
+}
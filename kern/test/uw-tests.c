@@ -243,6 +243,25 @@ vmstats_thread(void *junk, unsigned long num)
             }
             break;
 
+#if OPT_A3
+          /* Not cross-checked when printing */
+          case VMSTAT_FAULT_TEXT:
+          case VMSTAT_FAULT_DATA:
+          case VMSTAT_FAULT_HEAP:
+          case VMSTAT_FAULT_STACK:
+          case VMSTAT_FAULT_MMAP:
+          case VMSTAT_COW_COPY:
+          case VMSTAT_COW_REUSE:
+          case VMSTAT_EVICT_CLEAN:
+          case VMSTAT_EVICT_DIRTY:
+          case VMSTAT_FAULTAROUND_LOAD:
+          case VMSTAT_FAULTAROUND_HIT:
+          case VMSTAT_PREFETCH:
+          case VMSTAT_DONTNEED:
+            vmstats_inc(j);
+            break;
+#endif
+
           default:
             kprintf("Unknown stat %d\n", j);
             break;
@@ -218,6 +218,28 @@ lock_acquire(struct lock *lock)
     //(void)lock;  // suppress warning until code gets written
 }
 
+/*
+ * Take the lock only if nobody holds it. Returns true on success.
+ */
+bool
+lock_tryacquire(struct lock *lock)
+{
+    bool got;
+
+    KASSERT(lock != NULL);
+    KASSERT(!lock_do_i_hold(lock));
+
+    spinlock_acquire(&lock->lk_spin);
+    got = !lock->held;
+    if (got) {
+        lock->held = 1;
+        lock->owner = curthread;
+    }
+    spinlock_release(&lock->lk_spin);
+
+    return got;
+}
+
 void
 lock_release(struct lock *lock)
 {
@@ -52,6 +52,11 @@
 #include <vnode.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <kmem_cache.h>
+#endif
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -72,6 +77,12 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+#if OPT_A3
+/* Thread structures, and their stacks. */
+static struct kmem_cache *thread_cache;
+static struct kmem_cache *thread_stack_cache;
+#endif
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -111,6 +122,22 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+#if OPT_A3
+/*
+ * Cached threads keep their list node pointing at themselves, and
+ * unlinked (thread_destroy checks that).
+ */
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	threadlistnode_init(&thread->t_listnode, thread);
+	return 0;
+}
+#endif
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -123,14 +150,22 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
+#if OPT_A3
+	thread = kmem_cache_alloc(thread_cache);
+#else
 	thread = kmalloc(sizeof(*thread));
+#endif
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
+#if OPT_A3
+		kmem_cache_free(thread_cache, thread);
+#else
 		kfree(thread);
+#endif
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -138,7 +173,9 @@ thread_create(const char *name)
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
+#if !OPT_A3
 	threadlistnode_init(&thread->t_listnode, thread);
+#endif
 	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
@@ -214,7 +251,11 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
+#if OPT_A3
+		c->c_curthread->t_stack = kmem_cache_alloc(thread_stack_cache);
+#else
 		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+#endif
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -250,7 +291,11 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
+#if OPT_A3
+		kmem_cache_free(thread_stack_cache, thread->t_stack);
+#else
 		kfree(thread->t_stack);
+#endif
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -259,7 +304,11 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
+#if OPT_A3
+	kmem_cache_free(thread_cache, thread);
+#else
 	kfree(thread);
+#endif
 }
 
 /*
@@ -351,6 +400,16 @@ thread_bootstrap(void)
 
 	cpuarray_init(&allcpus);
 
+#if OPT_A3
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, NULL);
+	thread_stack_cache = kmem_cache_create("thread stack", STACK_SIZE,
+					       NULL, NULL);
+	if (thread_cache == NULL || thread_stack_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+#endif
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -493,7 +552,11 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
+#if OPT_A3
+	newthread->t_stack = kmem_cache_alloc(thread_stack_cache);
+#else
 	newthread->t_stack = kmalloc(STACK_SIZE);
+#endif
 	if (newthread->t_stack == NULL) {
 		thread_destroy(newthread);
 		return ENOMEM;
@@ -1140,6 +1203,81 @@ ipi_broadcast(int code)
 	}
 }
 
+#if OPT_A3
+/*
+ * Return the CPU numbered NUM, or NULL if there isn't one.
+ */
+struct cpu *
+cpu_bynumber(unsigned num)
+{
+	if (num >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, num);
+}
+
+/*
+ * Queue N mappings for TARGET to invalidate and send it one IPI for
+ * all of them. If they don't all fit, it flushes its whole TLB
+ * instead; MAPPINGS may be NULL to ask for that directly.
+ */
+void
+ipi_tlbshootdown_batch(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i;
+	int num;
+
+	spinlock_acquire(&target->c_ipi_lock);
+
+	if (mappings == NULL || n > TLBSHOOTDOWN_MAX) {
+		target->c_numshootdown = TLBSHOOTDOWN_ALL;
+	}
+	for (i = 0; i < n && target->c_numshootdown != TLBSHOOTDOWN_ALL; i++) {
+		num = target->c_numshootdown;
+		if (num == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+		}
+		else {
+			target->c_shootdown[num] = mappings[i];
+			target->c_numshootdown = num + 1;
+		}
+	}
+
+	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+	mainbus_send_ipi(target);
+
+	spinlock_release(&target->c_ipi_lock);
+}
+
+/*
+ * Wait until TARGET has handled every shootdown sent to it so far.
+ * Interrupts must be on, or two CPUs waiting for each other would
+ * never take each other's IPIs. The caller may migrate at any time, so
+ * TARGET may well be this CPU by now; then we take our own IPI and the
+ * wait ends just the same.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target)
+{
+	bool pending;
+
+	KASSERT(curthread->t_curspl == 0);
+
+	do {
+		spinlock_acquire(&target->c_ipi_lock);
+		pending = (target->c_ipi_pending &
+			   ((uint32_t)1 << IPI_TLBSHOOTDOWN)) != 0;
+		spinlock_release(&target->c_ipi_lock);
+	} while (pending);
+}
+
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	ipi_tlbshootdown_batch(target, mapping, 1);
+}
+#else
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
@@ -1161,6 +1299,7 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 
 	spinlock_release(&target->c_ipi_lock);
 }
+#endif /* OPT_A3 */
 
 void
 interprocessor_interrupt(void)
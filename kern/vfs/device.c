@@ -241,15 +241,19 @@ null_fsync(struct vnode *v)
 }
 
 /*
- * For mmap. If you want this to do anything, you have to write it
- * yourself. Some devices may not make sense to map. Others do.
+ * For mmap. Block devices can be mapped like files, through
+ * dev_read and dev_write; character devices can't.
  */
 static
 int
 dev_mmap(struct vnode *v  /* add stuff as needed */)
 {
-	(void)v;
-	return EUNIMP;
+	struct device *d = v->vn_data;
+
+	if (d->d_blocks == 0) {
+		return ENODEV;
+	}
+	return 0;
 }
 
 /*
@@ -0,0 +1,799 @@
+/*
+ * Buddy allocator for physical frames. See coremap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <platform/maxcpus.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+
+#define CM_NONE (-1)
+
+/*
+ * One entry per managed frame. Only the first frame of a block says
+ * anything about it: free blocks are marked with cme_free and their
+ * order, allocations with their length in pages.
+ *
+ * A user page mapped by exactly one address space also records that
+ * owner, so the clock can find the PTE to evict it. A page of a file's
+ * cache records the filemap and offset instead, and the filemap finds
+ * the PTEs (see filemap_evict). cme_as and cme_filemap are both NULL
+ * for kernel pages, shared private pages and pages whose owner isn't
+ * known yet; none of those are ever evicted.
+ */
+struct coremap_entry {
+	int cme_next;			/* free list links, frame indices */
+	int cme_prev;
+	unsigned cme_npages;		/* allocation length, 0 if not allocated */
+	unsigned cme_refcount;		/* mappings sharing a user frame */
+	struct addrspace *cme_as;	/* owner of a user page, or NULL */
+	vaddr_t cme_vaddr;		/* where cme_as maps it */
+	struct filemap *cme_filemap;	/* file cache holding it, or NULL */
+	off_t cme_fileoff;		/* its offset in the file */
+	unsigned cme_swapslot;		/* clean copy in swap, or SWAP_NOSLOT */
+	unsigned char cme_order;	/* order of a free block */
+	bool cme_free;			/* first frame of a free block */
+	bool cme_busy;			/* picked by the clock, being evicted */
+	bool cme_referenced;		/* mapped since the clock last passed */
+	void *cme_kmpage;		/* kmalloc's descriptor, for its pages */
+};
+
+static struct coremap_entry *coremap;
+static unsigned cm_nframes;		/* number of managed frames */
+static paddr_t cm_base;			/* physical address of frame 0 */
+
+static int cm_freelist[COREMAP_MAXORDER + 1];
+static unsigned cm_nfree[COREMAP_MAXORDER + 1];	/* blocks per order */
+static unsigned cm_freepages;
+
+/* Allocator counters, reported by coremap_printstats */
+static unsigned cm_allocs, cm_frees, cm_splits, cm_merges, cm_failures;
+
+/* Page replacement clock hand, a frame index */
+static unsigned cm_clockhand;
+
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Per-CPU free frame cache, indexed by cpu number. Frames in a cache
+ * are allocated as far as the buddy lists are concerned. The lock is
+ * normally only ever taken by its own CPU; other CPUs take it only to
+ * drain the cache when memory runs out. Lock order is pc_lock, then
+ * coremap_lock.
+ */
+struct pagecache {
+	struct spinlock pc_lock;
+	paddr_t pc_frames[PAGECACHE_SIZE];
+	unsigned pc_count;
+	unsigned pc_hits;		/* allocations served from the cache */
+	unsigned pc_refills;		/* batches taken from the buddy lists */
+	unsigned pc_drains;		/* batches returned to them */
+};
+
+static struct pagecache cm_pagecache[MAXCPUS];
+
+/*
+ * The high watermark and batch size, in one word so that a put on any
+ * CPU, which takes no lock in common with pagecache_tune, always sees
+ * a pair that was set together. (A new watermark with an old, larger
+ * batch would drain more frames than the cache holds.) Read it once.
+ */
+#define PCTUNE(high, batch)  (((high) << 16) | (batch))
+#define PCTUNE_HIGH(t)       ((t) >> 16)
+#define PCTUNE_BATCH(t)      ((t) & 0xffff)
+static volatile unsigned pagecache_tuning =
+	PCTUNE(PAGECACHE_HIGH, PAGECACHE_BATCH);
+
+static
+unsigned
+frame_index(paddr_t paddr)
+{
+	unsigned idx;
+
+	KASSERT(paddr >= cm_base);
+	KASSERT((paddr & PAGE_FRAME) == paddr);
+	idx = (paddr - cm_base) / PAGE_SIZE;
+	KASSERT(idx < cm_nframes);
+	return idx;
+}
+
+static
+void
+freelist_push(unsigned idx, unsigned order)
+{
+	struct coremap_entry *cme = &coremap[idx];
+
+	cme->cme_free = true;
+	cme->cme_order = order;
+	cme->cme_prev = CM_NONE;
+	cme->cme_next = cm_freelist[order];
+	if (cm_freelist[order] != CM_NONE) {
+		coremap[cm_freelist[order]].cme_prev = idx;
+	}
+	cm_freelist[order] = idx;
+	cm_nfree[order]++;
+}
+
+static
+void
+freelist_remove(unsigned idx)
+{
+	struct coremap_entry *cme = &coremap[idx];
+
+	KASSERT(cme->cme_free);
+	if (cme->cme_prev != CM_NONE) {
+		coremap[cme->cme_prev].cme_next = cme->cme_next;
+	}
+	else {
+		cm_freelist[cme->cme_order] = cme->cme_next;
+	}
+	if (cme->cme_next != CM_NONE) {
+		coremap[cme->cme_next].cme_prev = cme->cme_prev;
+	}
+	cm_nfree[cme->cme_order]--;
+	cme->cme_free = false;
+}
+
+/*
+ * Free the block of 2^ORDER frames at IDX, merging it with its buddy
+ * for as long as the buddy is a free block of the same size.
+ */
+static
+void
+buddy_free_block(unsigned idx, unsigned order)
+{
+	unsigned buddy;
+
+	while (order < COREMAP_MAXORDER) {
+		buddy = idx ^ (1U << order);
+		if (buddy >= cm_nframes || !coremap[buddy].cme_free ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < idx) {
+			idx = buddy;
+		}
+		order++;
+		cm_merges++;
+	}
+	freelist_push(idx, order);
+}
+
+/*
+ * Free NPAGES frames starting at IDX, which need not be a power of
+ * two, by splitting the range into the largest aligned blocks.
+ */
+static
+void
+buddy_free_range(unsigned idx, unsigned npages)
+{
+	unsigned order;
+
+	while (npages > 0) {
+		order = 0;
+		while (order < COREMAP_MAXORDER &&
+		       (idx & ((2U << order) - 1)) == 0 &&
+		       (2U << order) <= npages) {
+			order++;
+		}
+		buddy_free_block(idx, order);
+		idx += 1U << order;
+		npages -= 1U << order;
+	}
+}
+
+/*
+ * Take a free block of 2^ORDER frames, splitting a larger one if
+ * necessary. Returns its index, or CM_NONE.
+ */
+static
+int
+buddy_alloc_block(unsigned order)
+{
+	unsigned o;
+	int idx;
+
+	for (o = order; o <= COREMAP_MAXORDER; o++) {
+		if (cm_freelist[o] != CM_NONE) {
+			break;
+		}
+	}
+	if (o > COREMAP_MAXORDER) {
+		return CM_NONE;
+	}
+
+	idx = cm_freelist[o];
+	freelist_remove(idx);
+
+	/* Give back the upper half until the block is the right size. */
+	while (o > order) {
+		o--;
+		freelist_push(idx + (1U << o), o);
+		cm_splits++;
+	}
+	return idx;
+}
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t low, high;
+	unsigned i;
+
+	// Get remaining memory
+	ram_getsize(&low, &high);
+
+	coremap = (struct coremap_entry *) PADDR_TO_KVADDR(low);
+
+	// Find necessary space for coremap
+	cm_nframes = (high - low) / PAGE_SIZE;
+	low += cm_nframes * sizeof(struct coremap_entry);
+	low = ROUNDUP(low, PAGE_SIZE);
+	cm_nframes = (high - low) / PAGE_SIZE;
+	cm_base = low;
+
+	for (i = 0; i < cm_nframes; i++) {
+		coremap[i].cme_next = CM_NONE;
+		coremap[i].cme_prev = CM_NONE;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_filemap = NULL;
+		coremap[i].cme_fileoff = 0;
+		coremap[i].cme_swapslot = SWAP_NOSLOT;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_free = false;
+		coremap[i].cme_busy = false;
+		coremap[i].cme_referenced = false;
+		coremap[i].cme_kmpage = NULL;
+	}
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		cm_freelist[i] = CM_NONE;
+		cm_nfree[i] = 0;
+	}
+	for (i = 0; i < MAXCPUS; i++) {
+		spinlock_init(&cm_pagecache[i].pc_lock);
+		cm_pagecache[i].pc_count = 0;
+		cm_pagecache[i].pc_hits = 0;
+		cm_pagecache[i].pc_refills = 0;
+		cm_pagecache[i].pc_drains = 0;
+	}
+
+	buddy_free_range(0, cm_nframes);
+	cm_freepages = cm_nframes;
+	cm_merges = 0;
+	cm_clockhand = 0;
+}
+
+/*
+ * Move up to a batch of single frames from the buddy lists into PC.
+ * Called with pc_lock held.
+ */
+static
+void
+pagecache_refill(struct pagecache *pc)
+{
+	unsigned i, batch;
+	int idx;
+
+	batch = PCTUNE_BATCH(pagecache_tuning);
+
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < batch; i++) {
+		idx = buddy_alloc_block(0);
+		if (idx == CM_NONE) {
+			break;
+		}
+		coremap[idx].cme_npages = 1;
+		pc->pc_frames[pc->pc_count++] = cm_base + idx * PAGE_SIZE;
+		cm_freepages--;
+		cm_allocs++;
+	}
+	if (i == 0) {
+		cm_failures++;
+	}
+	spinlock_release(&coremap_lock);
+	if (i > 0) {
+		pc->pc_refills++;
+	}
+}
+
+/*
+ * Return NFRAMES frames from PC to the buddy lists. Called with
+ * pc_lock held.
+ */
+static
+void
+pagecache_drain(struct pagecache *pc, unsigned nframes)
+{
+	unsigned idx;
+
+	KASSERT(nframes <= pc->pc_count);
+
+	spinlock_acquire(&coremap_lock);
+	while (nframes-- > 0) {
+		idx = frame_index(pc->pc_frames[--pc->pc_count]);
+		coremap[idx].cme_npages = 0;
+		buddy_free_block(idx, 0);
+		cm_freepages++;
+		cm_frees++;
+	}
+	spinlock_release(&coremap_lock);
+	pc->pc_drains++;
+}
+
+/* Empty every CPU's cache; used when the buddy lists run out. */
+static
+void
+pagecache_drainall(void)
+{
+	struct pagecache *pc;
+	unsigned i;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		pc = &cm_pagecache[i];
+		spinlock_acquire(&pc->pc_lock);
+		if (pc->pc_count > 0) {
+			pagecache_drain(pc, pc->pc_count);
+		}
+		spinlock_release(&pc->pc_lock);
+	}
+}
+
+static
+paddr_t
+pagecache_get(void)
+{
+	struct pagecache *pc;
+	paddr_t paddr;
+
+	/*
+	 * If we migrate after reading curcpu we just use another
+	 * CPU's cache for once; the lock keeps that safe.
+	 */
+	pc = &cm_pagecache[curcpu->c_number];
+
+	spinlock_acquire(&pc->pc_lock);
+	if (pc->pc_count == 0) {
+		pagecache_refill(pc);
+	}
+	else {
+		pc->pc_hits++;
+	}
+	paddr = pc->pc_count > 0 ? pc->pc_frames[--pc->pc_count] : 0;
+	spinlock_release(&pc->pc_lock);
+
+	return paddr;
+}
+
+static
+void
+pagecache_put(paddr_t paddr)
+{
+	struct pagecache *pc;
+	unsigned tuning;
+
+	pc = &cm_pagecache[curcpu->c_number];
+
+	spinlock_acquire(&pc->pc_lock);
+	KASSERT(pc->pc_count < PAGECACHE_SIZE);
+	pc->pc_frames[pc->pc_count++] = paddr;
+	/* batch <= high < pc_count, so the drain is never too big. */
+	tuning = pagecache_tuning;
+	if (pc->pc_count > PCTUNE_HIGH(tuning)) {
+		pagecache_drain(pc, PCTUNE_BATCH(tuning));
+	}
+	spinlock_release(&pc->pc_lock);
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	unsigned order;
+	int idx;
+	paddr_t paddr;
+
+	KASSERT(npages > 0);
+
+	if (npages == 1) {
+		paddr = pagecache_get();
+		if (paddr == 0) {
+			pagecache_drainall();
+			paddr = pagecache_get();
+			if (paddr == 0) {
+				return 0;
+			}
+		}
+		/* The frame is ours alone, so no lock is needed. */
+		coremap[frame_index(paddr)].cme_refcount = 1;
+		return paddr;
+	}
+
+	order = 0;
+	while ((1UL << order) < npages) {
+		order++;
+	}
+	if (order > COREMAP_MAXORDER) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	idx = buddy_alloc_block(order);
+	if (idx == CM_NONE) {
+		/* Cached single frames may be what's keeping us short. */
+		spinlock_release(&coremap_lock);
+		pagecache_drainall();
+		spinlock_acquire(&coremap_lock);
+		idx = buddy_alloc_block(order);
+	}
+	if (idx == CM_NONE) {
+		cm_failures++;
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	/* Return the unneeded tail of the block right away. */
+	if ((1UL << order) > npages) {
+		buddy_free_range(idx + npages, (1U << order) - npages);
+	}
+
+	coremap[idx].cme_npages = npages;
+	coremap[idx].cme_refcount = 1;
+	cm_freepages -= npages;
+	cm_allocs++;
+
+	spinlock_release(&coremap_lock);
+
+	return cm_base + idx * PAGE_SIZE;
+}
+
+/* Called with coremap_lock held. */
+static
+void
+coremap_release(unsigned idx)
+{
+	unsigned npages;
+
+	npages = coremap[idx].cme_npages;
+	KASSERT(npages > 0);
+
+	coremap[idx].cme_npages = 0;
+	coremap[idx].cme_refcount = 0;
+	buddy_free_range(idx, npages);
+	cm_freepages += npages;
+	cm_frees++;
+}
+
+void
+coremap_free(paddr_t paddr)
+{
+	unsigned idx;
+
+	idx = frame_index(paddr);
+	KASSERT(coremap[idx].cme_npages > 0);
+
+	/* Single frames go back through this CPU's cache. */
+	if (coremap[idx].cme_npages == 1) {
+		coremap[idx].cme_refcount = 0;
+		pagecache_put(paddr);
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	coremap_release(idx);
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[frame_index(paddr)];
+	KASSERT(cme->cme_npages == 1 && cme->cme_refcount > 0);
+	KASSERT(cme->cme_swapslot == SWAP_NOSLOT);
+	cme->cme_refcount++;
+	cme->cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_decref(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	unsigned idx, refcount;
+
+	spinlock_acquire(&coremap_lock);
+	idx = frame_index(paddr);
+	cme = &coremap[idx];
+	KASSERT(cme->cme_npages == 1 && cme->cme_refcount > 0);
+	/*
+	 * The clock may have just picked the page. It gives it back as
+	 * soon as it fails to get the owner's lock, which our caller
+	 * holds, or for a file page as soon as it has the filemap's.
+	 */
+	while (cme->cme_busy) {
+		spinlock_release(&coremap_lock);
+		thread_yield();
+		spinlock_acquire(&coremap_lock);
+	}
+	refcount = --cme->cme_refcount;
+	/* Whoever is left gets recorded again on their next fault. */
+	cme->cme_as = NULL;
+	cme->cme_referenced = false;
+	if (refcount == 0) {
+		KASSERT(cme->cme_swapslot == SWAP_NOSLOT);
+		KASSERT(cme->cme_filemap == NULL);
+	}
+	spinlock_release(&coremap_lock);
+
+	if (refcount == 0) {
+		/* nobody else can find the frame any more */
+		pagecache_put(paddr);
+	}
+	return refcount;
+}
+
+unsigned
+coremap_refcount(paddr_t paddr)
+{
+	unsigned refcount;
+
+	spinlock_acquire(&coremap_lock);
+	refcount = coremap[frame_index(paddr)].cme_refcount;
+	spinlock_release(&coremap_lock);
+	return refcount;
+}
+
+unsigned
+coremap_nframes(void)
+{
+	return cm_nframes;
+}
+
+unsigned
+coremap_freeframes(void)
+{
+	/* a snapshot; not worth the lock */
+	return cm_freepages;
+}
+
+void
+coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *cme;
+
+	KASSERT(as != NULL);
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[frame_index(paddr)];
+	KASSERT(cme->cme_npages == 1 && cme->cme_refcount > 0);
+	cme->cme_referenced = true;
+	if (cme->cme_refcount == 1 && cme->cme_filemap == NULL) {
+		cme->cme_as = as;
+		cme->cme_vaddr = vaddr;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * No lock: kmalloc sets the descriptor before it hands out any of the
+ * page and clears it after getting all of it back, so anyone freeing
+ * a block of the page sees it set.
+ */
+void
+coremap_setkmpage(paddr_t paddr, void *kp)
+{
+	if (paddr >= cm_base && paddr < cm_base + cm_nframes * PAGE_SIZE) {
+		coremap[frame_index(paddr)].cme_kmpage = kp;
+	}
+}
+
+void *
+coremap_kmpage(paddr_t paddr, bool *managed)
+{
+	paddr &= PAGE_FRAME;
+	*managed = paddr >= cm_base && paddr < cm_base + cm_nframes * PAGE_SIZE;
+	return *managed ? coremap[frame_index(paddr)].cme_kmpage : NULL;
+}
+
+void
+coremap_deactivate(paddr_t paddr)
+{
+	spinlock_acquire(&coremap_lock);
+	coremap[frame_index(paddr)].cme_referenced = false;
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setfile(paddr_t paddr, struct filemap *fm, off_t offset)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[frame_index(paddr)];
+	KASSERT(cme->cme_npages == 1 && cme->cme_refcount > 0);
+	KASSERT(cme->cme_as == NULL);
+	cme->cme_filemap = fm;
+	cme->cme_fileoff = offset;
+	spinlock_release(&coremap_lock);
+}
+
+paddr_t
+coremap_clock(struct addrspace **as, vaddr_t *vaddr, struct filemap **fm,
+	      off_t *offset, bool *referenced)
+{
+	struct coremap_entry *cme;
+	unsigned i, idx;
+	paddr_t paddr;
+
+	paddr = 0;
+	spinlock_acquire(&coremap_lock);
+	for (i = 0; i < cm_nframes; i++) {
+		idx = cm_clockhand;
+		cm_clockhand = (cm_clockhand + 1) % cm_nframes;
+
+		cme = &coremap[idx];
+		if ((cme->cme_as == NULL && cme->cme_filemap == NULL) ||
+		    cme->cme_busy) {
+			continue;
+		}
+		KASSERT(cme->cme_npages == 1);
+		KASSERT(cme->cme_filemap != NULL || cme->cme_refcount == 1);
+
+		cme->cme_busy = true;
+		*as = cme->cme_as;
+		*vaddr = cme->cme_vaddr;
+		*fm = cme->cme_filemap;
+		*offset = cme->cme_fileoff;
+		*referenced = cme->cme_referenced;
+		cme->cme_referenced = false;
+		paddr = cm_base + idx * PAGE_SIZE;
+		break;
+	}
+	spinlock_release(&coremap_lock);
+
+	return paddr;
+}
+
+void
+coremap_unbusy(paddr_t paddr, bool evicted)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[frame_index(paddr)];
+	KASSERT(cme->cme_busy);
+	cme->cme_busy = false;
+	if (evicted) {
+		cme->cme_as = NULL;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_setslot(paddr_t paddr, unsigned slot)
+{
+	struct coremap_entry *cme;
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[frame_index(paddr)];
+	KASSERT(cme->cme_npages == 1 && cme->cme_refcount == 1);
+	KASSERT(cme->cme_swapslot == SWAP_NOSLOT);
+	cme->cme_swapslot = slot;
+	spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_takeslot(paddr_t paddr)
+{
+	struct coremap_entry *cme;
+	unsigned slot;
+
+	spinlock_acquire(&coremap_lock);
+	cme = &coremap[frame_index(paddr)];
+	slot = cme->cme_swapslot;
+	cme->cme_swapslot = SWAP_NOSLOT;
+	spinlock_release(&coremap_lock);
+
+	return slot;
+}
+
+/*
+ * Print the free lists and a fragmentation summary. The numbers are
+ * copied out under the lock because kprintf may sleep.
+ */
+void
+coremap_printstats(void)
+{
+	unsigned nfree[COREMAP_MAXORDER + 1];
+	unsigned freepages, largest, allocs, frees, splits, merges, failures;
+	unsigned cached;
+	unsigned i;
+
+	cached = 0;
+	for (i = 0; i < MAXCPUS; i++) {
+		cached += cm_pagecache[i].pc_count;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	largest = 0;
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		nfree[i] = cm_nfree[i];
+		if (nfree[i] > 0) {
+			largest = 1U << i;
+		}
+	}
+	freepages = cm_freepages;
+	allocs = cm_allocs;
+	frees = cm_frees;
+	splits = cm_splits;
+	merges = cm_merges;
+	failures = cm_failures;
+	spinlock_release(&coremap_lock);
+
+	kprintf("Coremap: %u frames, %u free (%uk), %u more in per-CPU caches\n",
+		cm_nframes, freepages, freepages * PAGE_SIZE / 1024, cached);
+	kprintf("    order  pages  free blocks\n");
+	for (i = 0; i <= COREMAP_MAXORDER; i++) {
+		kprintf("    %5u  %5u  %11u\n", i, 1U << i, nfree[i]);
+	}
+	/*
+	 * Fragmentation: the share of free memory that is not in the
+	 * largest free block, i.e. 0% when all free memory is one block.
+	 */
+	kprintf("Largest free block: %u pages; fragmentation %u%%\n",
+		largest, freepages == 0 ? 0 : 100 - (100 * largest) / freepages);
+	kprintf("allocs %u, frees %u, splits %u, merges %u, failed %u\n",
+		allocs, frees, splits, merges, failures);
+}
+
+int
+pagecache_tune(unsigned high, unsigned batch)
+{
+	if (high >= PAGECACHE_SIZE || batch == 0 || batch > high) {
+		return EINVAL;
+	}
+	pagecache_tuning = PCTUNE(high, batch);
+	return 0;
+}
+
+void
+pagecache_printstats(void)
+{
+	struct pagecache *pc;
+	unsigned count, hits, refills, drains;
+	unsigned i, tuning;
+
+	tuning = pagecache_tuning;
+	kprintf("Per-CPU page caches: high watermark %u, batch %u\n",
+		PCTUNE_HIGH(tuning), PCTUNE_BATCH(tuning));
+	for (i = 0; i < MAXCPUS; i++) {
+		pc = &cm_pagecache[i];
+
+		spinlock_acquire(&pc->pc_lock);
+		count = pc->pc_count;
+		hits = pc->pc_hits;
+		refills = pc->pc_refills;
+		drains = pc->pc_drains;
+		spinlock_release(&pc->pc_lock);
+
+		if (hits == 0 && refills == 0) {
+			/* no such cpu, or it never allocated */
+			continue;
+		}
+		kprintf("    cpu%u: %u cached, %u hits, %u refills, "
+			"%u drains\n", i, count, hits, refills, drains);
+	}
+}
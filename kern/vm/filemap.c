@@ -0,0 +1,423 @@
+/*
+ * Per-vnode page cache for mapped files and shared text. See filemap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <array.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <coremap.h>
+#include <pagetable.h>
+#include <filemap.h>
+#include <uw-vmstats.h>
+
+/* A region mapping the file, so the pager can find its PTEs. */
+struct fmmap {
+	struct addrspace *fmm_as;
+	struct region *fmm_rg;
+	struct fmmap *fmm_next;
+};
+
+/*
+ * A cached page whose entry in fm_pages has PTE_MODIFIED set was
+ * written through a mapping that has since let go of it, and still
+ * has to be written back.
+ */
+struct filemap {
+	struct vnode *fm_vnode;
+	unsigned fm_refcount;		/* mappings; protected by filemap_lock */
+	struct lock *fm_lock;		/* for everything below */
+	struct fmmap *fm_maps;		/* the mappings */
+	struct pagetable *fm_pages;	/* cached frames, by file offset */
+	unsigned fm_npages;
+};
+
+/* All filemaps. The lock covers the array and the reference counts. */
+static struct array *filemaps;
+static struct lock *filemap_lock;
+
+/* Counters, under filemap_lock. */
+static unsigned fm_hits, fm_misses, fm_writebacks;
+
+void
+filemap_bootstrap(void)
+{
+	filemaps = array_create();
+	filemap_lock = lock_create("filemap");
+	if (filemaps == NULL || filemap_lock == NULL) {
+		panic("filemap: out of memory\n");
+	}
+}
+
+/* Add FMM to the mappings of FM. */
+static
+void
+fm_addmap(struct filemap *fm, struct fmmap *fmm)
+{
+	lock_acquire(fm->fm_lock);
+	fmm->fmm_next = fm->fm_maps;
+	fm->fm_maps = fmm;
+	lock_release(fm->fm_lock);
+}
+
+/*
+ * Write the page at OFFSET, in frame PADDR, back to the file, up to
+ * EOF, and clear any writeback still owed for it. Called with fm_lock.
+ */
+static
+int
+fm_write(struct filemap *fm, off_t offset, paddr_t paddr, pte_t *pte)
+{
+	struct iovec iov;
+	struct uio u;
+	struct stat st;
+	size_t len;
+	int result;
+
+	KASSERT(lock_do_i_hold(fm->fm_lock));
+
+	/* Mappings don't extend the file. */
+	result = VOP_STAT(fm->fm_vnode, &st);
+	if (result) {
+		return result;
+	}
+	if (offset < st.st_size) {
+		len = st.st_size - offset < PAGE_SIZE ?
+			st.st_size - offset : PAGE_SIZE;
+		uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(paddr), len,
+			  offset, UIO_WRITE);
+		result = VOP_WRITE(fm->fm_vnode, &u);
+		if (result) {
+			return result;
+		}
+	}
+	*pte &= ~PTE_MODIFIED;
+	return 0;
+}
+
+struct filemap *
+filemap_get(struct vnode *v, struct addrspace *as, struct region *rg)
+{
+	struct filemap *fm;
+	struct fmmap *fmm;
+	unsigned i;
+
+	fmm = kmalloc(sizeof(struct fmmap));
+	if (fmm == NULL) {
+		return NULL;
+	}
+	fmm->fmm_as = as;
+	fmm->fmm_rg = rg;
+
+	lock_acquire(filemap_lock);
+
+	for (i = 0; i < array_num(filemaps); i++) {
+		fm = array_get(filemaps, i);
+		if (fm->fm_vnode == v) {
+			fm->fm_refcount++;
+			lock_release(filemap_lock);
+			fm_addmap(fm, fmm);
+			return fm;
+		}
+	}
+
+	fm = kmalloc(sizeof(struct filemap));
+	if (fm == NULL) {
+		goto fail;
+	}
+	fm->fm_lock = lock_create("filemap page");
+	if (fm->fm_lock == NULL) {
+		goto fail_fm;
+	}
+	fm->fm_pages = pt_create();
+	if (fm->fm_pages == NULL) {
+		goto fail_lock;
+	}
+	if (array_add(filemaps, fm, NULL)) {
+		goto fail_pages;
+	}
+	VOP_INCREF(v);
+	fm->fm_vnode = v;
+	fm->fm_refcount = 1;
+	fm->fm_maps = NULL;
+	fm->fm_npages = 0;
+
+	lock_release(filemap_lock);
+	fm_addmap(fm, fmm);
+	return fm;
+
+ fail_pages:
+	pt_destroy(fm->fm_pages);
+ fail_lock:
+	lock_destroy(fm->fm_lock);
+ fail_fm:
+	kfree(fm);
+ fail:
+	lock_release(filemap_lock);
+	kfree(fmm);
+	return NULL;
+}
+
+int
+filemap_addmap(struct filemap *fm, struct addrspace *as, struct region *rg)
+{
+	struct fmmap *fmm;
+
+	fmm = kmalloc(sizeof(struct fmmap));
+	if (fmm == NULL) {
+		return ENOMEM;
+	}
+	fmm->fmm_as = as;
+	fmm->fmm_rg = rg;
+
+	lock_acquire(filemap_lock);
+	KASSERT(fm->fm_refcount > 0);
+	fm->fm_refcount++;
+	lock_release(filemap_lock);
+
+	fm_addmap(fm, fmm);
+	return 0;
+}
+
+void
+filemap_put(struct filemap *fm, struct region *rg)
+{
+	struct fmmap **p, *fmm;
+	vaddr_t off;
+	pte_t *pte;
+	paddr_t pa;
+	unsigned i;
+
+	lock_acquire(fm->fm_lock);
+	for (p = &fm->fm_maps; (*p)->fmm_rg != rg; p = &(*p)->fmm_next) {
+		KASSERT((*p)->fmm_next != NULL);
+	}
+	fmm = *p;
+	*p = fmm->fmm_next;
+	lock_release(fm->fm_lock);
+	kfree(fmm);
+
+	lock_acquire(filemap_lock);
+	KASSERT(fm->fm_refcount > 0);
+	if (--fm->fm_refcount > 0) {
+		lock_release(filemap_lock);
+		return;
+	}
+	for (i = 0; i < array_num(filemaps); i++) {
+		if (array_get(filemaps, i) == fm) {
+			array_remove(filemaps, i);
+			break;
+		}
+	}
+	lock_release(filemap_lock);
+
+	/*
+	 * Nobody maps it now, but writes from mappings that have let go
+	 * of a page may still be owed. Holding the lock keeps the pager
+	 * off the pages until they are gone.
+	 */
+	lock_acquire(fm->fm_lock);
+	KASSERT(fm->fm_maps == NULL);
+	off = 0;
+	while ((pte = pt_next(fm->fm_pages, &off)) != NULL) {
+		pa = *pte & PTE_FRAME;
+		if (*pte & PTE_MODIFIED) {
+			/* nobody to report an error to */
+			(void)fm_write(fm, off, pa, pte);
+		}
+		coremap_setfile(pa, NULL, 0);
+		coremap_decref(pa);
+		off += PAGE_SIZE;
+	}
+	lock_release(fm->fm_lock);
+
+	pt_destroy(fm->fm_pages);
+	lock_destroy(fm->fm_lock);
+	VOP_DECREF(fm->fm_vnode);
+	kfree(fm);
+}
+
+int
+filemap_getpage(struct filemap *fm, off_t offset, paddr_t *paddr,
+		bool *fromdisk)
+{
+	struct iovec iov;
+	struct uio u;
+	pte_t *pte;
+	paddr_t pa;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+	if (offset < 0 || offset >= USERSPACETOP) {
+		return EFBIG;
+	}
+
+	lock_acquire(fm->fm_lock);
+
+	pte = pt_lookup(fm->fm_pages, offset, true);
+	if (pte == NULL) {
+		lock_release(fm->fm_lock);
+		return ENOMEM;
+	}
+	if (*pte & PTE_VALID) {
+		pa = *pte & PTE_FRAME;
+		*fromdisk = false;
+	}
+	else {
+		/* This may page out, even other pages of ours. */
+		pa = alloc_upage();
+		if (pa == 0) {
+			lock_release(fm->fm_lock);
+			return ENOMEM;
+		}
+		/* A short read leaves the rest of the page zero. */
+		uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+			  offset, UIO_READ);
+		result = VOP_READ(fm->fm_vnode, &u);
+		if (result) {
+			coremap_decref(pa);
+			lock_release(fm->fm_lock);
+			return result;
+		}
+		*pte = pa | PTE_VALID;
+		fm->fm_npages++;
+		coremap_setfile(pa, fm, offset);
+		*fromdisk = true;
+	}
+	coremap_incref(pa);
+
+	lock_release(fm->fm_lock);
+
+	lock_acquire(filemap_lock);
+	if (*fromdisk) {
+		fm_misses++;
+	}
+	else {
+		fm_hits++;
+	}
+	lock_release(filemap_lock);
+
+	*paddr = pa;
+	return 0;
+}
+
+int
+filemap_writeback(struct filemap *fm, off_t offset)
+{
+	pte_t *pte;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	lock_acquire(fm->fm_lock);
+
+	pte = pt_lookup(fm->fm_pages, offset, false);
+	if (pte == NULL || !(*pte & PTE_VALID)) {
+		lock_release(fm->fm_lock);
+		return 0;
+	}
+	result = fm_write(fm, offset, *pte & PTE_FRAME, pte);
+
+	lock_release(fm->fm_lock);
+
+	if (result == 0) {
+		lock_acquire(filemap_lock);
+		fm_writebacks++;
+		lock_release(filemap_lock);
+	}
+	return result;
+}
+
+/*
+ * The pager must not sleep waiting for a lock, so anything held by
+ * someone else makes us give up on the page for now. We may hold
+ * fm_lock already, if the allocation in filemap_getpage brought us
+ * here. The page stays ours meanwhile: it is only taken out of the
+ * cache with fm_lock held, and the teardown in filemap_put waits for
+ * the clock to hand it back before it can get that far.
+ *
+ * Don't touch filemap_lock in here: it is held across allocations.
+ */
+bool
+filemap_evict(struct filemap *fm, off_t offset, paddr_t paddr)
+{
+	struct fmmap *fmm;
+	pte_t *pte;
+	bool locked, modified, dirty, freed;
+
+	if (lock_do_i_hold(fm->fm_lock)) {
+		locked = false;
+	}
+	else if (lock_tryacquire(fm->fm_lock)) {
+		locked = true;
+	}
+	else {
+		coremap_unbusy(paddr, false);
+		return false;
+	}
+	/* fm_lock keeps other pagers off it now. */
+	coremap_unbusy(paddr, false);
+
+	pte = pt_lookup(fm->fm_pages, offset, false);
+	KASSERT(pte != NULL);
+	KASSERT((*pte & (PTE_VALID | PTE_FRAME)) == (paddr | PTE_VALID));
+
+	/* Mappings we get through before giving up just fault it back. */
+	freed = false;
+	modified = false;
+	for (fmm = fm->fm_maps; fmm != NULL; fmm = fmm->fmm_next) {
+		if (as_unmapfile(fmm->fmm_as, fmm->fmm_rg, offset, paddr,
+				 &modified)) {
+			goto done;
+		}
+	}
+	/* e.g. a fork still copying PTEs */
+	if (coremap_refcount(paddr) > 1) {
+		goto done;
+	}
+
+	dirty = modified || (*pte & PTE_MODIFIED);
+	if (dirty && fm_write(fm, offset, paddr, pte)) {
+		goto done;
+	}
+	*pte = 0;
+	fm->fm_npages--;
+	coremap_setfile(paddr, NULL, 0);
+	coremap_decref(paddr);
+	vmstats_inc(dirty ? VMSTAT_EVICT_DIRTY : VMSTAT_EVICT_CLEAN);
+	freed = true;
+
+ done:
+	if (!freed && modified) {
+		*pte |= PTE_MODIFIED;
+	}
+	if (locked) {
+		lock_release(fm->fm_lock);
+	}
+	return freed;
+}
+
+void
+filemap_printstats(void)
+{
+	struct filemap *fm;
+	unsigned i, nmaps, npages;
+
+	lock_acquire(filemap_lock);
+	nmaps = array_num(filemaps);
+	npages = 0;
+	for (i = 0; i < nmaps; i++) {
+		fm = array_get(filemaps, i);
+		npages += fm->fm_npages;
+	}
+	kprintf("File page caches: %u files, %u pages, %u hits, "
+		"%u misses, %u writebacks\n", nmaps, npages, fm_hits,
+		fm_misses, fm_writebacks);
+	lock_release(filemap_lock);
+}
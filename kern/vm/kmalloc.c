@@ -31,6 +31,18 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <vm.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+#include <cpu.h>
+#include <current.h>
+#include <spl.h>
+#include <platform/maxcpus.h>
+#include <kern/errno.h>
+#include <clock.h>
+#include <coremap.h>
+#include <kmem_cache.h>
+#endif
 
 /*
  * Kernel malloc.
@@ -83,11 +95,61 @@ fill_deadbeef(void *vptr, size_t len)
 
 #if PAGE_SIZE == 4096
 
+#if OPT_A3
+/*
+ * Besides the powers of two, there are classes fitted to the sizes of
+ * the structures the kernel allocates most: 24 (lock, semaphore), 40
+ * (wchan), 112 (thread), 160 (trapframe), 320 (addrspace), and 584
+ * (sfs_vnode, sfs_fs and other buffers just over 512). The classes
+ * above 512 are the largest that fit 7, 6, 5 and 3 blocks on a page.
+ * Sizes must be multiples of 8 and in increasing order. The kmalloc
+ * profiler's size histogram (kprof) shows whether they still fit.
+ *
+ * The table is given once, as SIZECLASSES, and everything else is
+ * generated from it by the compiler: sizes[], NSIZES, and the
+ * sizeclass[] table that maps a size, in units of 8 bytes rounded up,
+ * to its class in one lookup.
+ */
+#define SIZECLASSES(C, n) \
+	C(16, n) C(24, n) C(32, n) C(40, n) C(48, n) C(64, n) \
+	C(80, n) C(96, n) C(112, n) C(128, n) C(160, n) C(192, n) \
+	C(256, n) C(320, n) C(384, n) C(512, n) C(584, n) C(680, n) \
+	C(816, n) C(1024, n) C(1360, n) C(2048, n)
+
+#define SC_SIZE(s, n)     s,
+#define SC_COUNT(s, n)    + 1
+#define SC_BELOW(s, n)    + ((n) > (s))
+#define SC_ODD(s, n)      + ((s) % 8 != 0)
+
+#define NSIZES (0 SIZECLASSES(SC_COUNT, 0))
+static const size_t sizes[NSIZES] = { SIZECLASSES(SC_SIZE, 0) };
+
+/* The class for N bytes: the number of classes smaller than N. */
+#define SIZECLASS(n) (0 SIZECLASSES(SC_BELOW, n))
+
+#define SC1(i)   SIZECLASS((i) * 8),
+#define SC4(i)   SC1(i) SC1((i)+1) SC1((i)+2) SC1((i)+3)
+#define SC16(i)  SC4(i) SC4((i)+4) SC4((i)+8) SC4((i)+12)
+#define SC64(i)  SC16(i) SC16((i)+16) SC16((i)+32) SC16((i)+48)
+#define SC256(i) SC64(i) SC64((i)+64) SC64((i)+128) SC64((i)+192)
+
+#define SMALLEST_SUBPAGE_SIZE 16
+#define LARGEST_SUBPAGE_SIZE 2048
+
+static const uint8_t sizeclass[LARGEST_SUBPAGE_SIZE / 8 + 1] = {
+	SC256(0) SC1(256)
+};
+
+/* Fails to compile if a size isn't a multiple of 8. */
+typedef char sizeclasses_aligned[(0 SIZECLASSES(SC_ODD, 0)) ? -1 : 1];
+
+#else
 #define NSIZES 8
 static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 
 #define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
+#endif /* OPT_A3 */
 
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
@@ -193,10 +255,37 @@ static struct pageref *allbase;
  * logic per-cpu is worthwhile for scalability; however, for the time
  * being at least we won't, because it adds a lot of complexity and in
  * OS/161 performance and scalability aren't super-critical.
+ *
+ * (With OPT_A3 we do, in front of it: see the per-CPU magazines.)
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+#if OPT_A3
+/*
+ * How often kmalloc_spinlock is taken, and what for; under the lock.
+ * With the magazines below working, allocations should hardly ever
+ * need it.
+ */
+#define KMLOCK_ALLOC   0	/* allocating from the pages */
+#define KMLOCK_FREE    1	/* freeing to them, or finding the page */
+#define KMLOCK_DEPOT   2	/* magazines to and from the depot */
+#define KMLOCK_OTHER   3	/* statistics */
+#define KMLOCK_COUNT   4
+
+static unsigned km_lockholds[KMLOCK_COUNT];
+
+static
+void
+kmalloc_lock(unsigned why)
+{
+	spinlock_acquire(&kmalloc_spinlock);
+	km_lockholds[why]++;
+}
+#else
+#define kmalloc_lock(why) spinlock_acquire(&kmalloc_spinlock)
+#endif
+
 ////////////////////////////////////////
 
 /* SLOWER implies SLOW */
@@ -330,21 +419,119 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+#if OPT_A3
+/*
+ * Requests per size class, for the internal fragmentation figures in
+ * kheap_printstats, which sums and resets them. Kept per CPU and
+ * updated with interrupts off so we stay on it; the sums may miss a
+ * request or two.
+ */
+struct kmsizes {
+	unsigned ks_allocs[NSIZES];
+	unsigned ks_asked[NSIZES];	/* bytes asked for */
+};
+static struct kmsizes km_sizes[MAXCPUS];
+
+static
+void
+kmalloc_countsize(unsigned blktype, size_t sz)
+{
+	struct kmsizes *ks;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* Early in boot: one CPU, and interrupts are off. */
+		km_sizes[0].ks_allocs[blktype]++;
+		km_sizes[0].ks_asked[blktype] += sz;
+		return;
+	}
+	spl = splhigh();
+	ks = &km_sizes[curcpu->c_number];
+	ks->ks_allocs[blktype]++;
+	ks->ks_asked[blktype] += sz;
+	splx(spl);
+}
+
+/*
+ * Print, for each size class, how its blocks fit on a page, how many
+ * are in use, and how much of a block the requests since last time
+ * left unused on average. The bytes wasted in the blocks in use are
+ * estimated from that average.
+ */
+static
+void
+kheap_printfrag(void)
+{
+	unsigned pages[NSIZES], inuse[NSIZES];
+	unsigned allocs, asked, avg, blockbytes, wasted;
+	struct pageref *pr;
+	unsigned i, blktype;
+
+	for (blktype = 0; blktype < NSIZES; blktype++) {
+		pages[blktype] = inuse[blktype] = 0;
+	}
+	kmalloc_lock(KMLOCK_OTHER);
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		blktype = PR_BLOCKTYPE(pr);
+		pages[blktype]++;
+		inuse[blktype] += PAGE_SIZE / sizes[blktype] - pr->nfree;
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	kprintf("Size classes (requests since the last kh):\n");
+	kprintf("%6s %6s %5s %6s %7s %8s %6s %6s\n", "size", "blocks",
+		"tail", "pages", "in use", "allocs", "asked", "waste");
+	blockbytes = wasted = 0;
+	for (blktype = 0; blktype < NSIZES; blktype++) {
+		allocs = asked = 0;
+		for (i = 0; i < MAXCPUS; i++) {
+			allocs += km_sizes[i].ks_allocs[blktype];
+			asked += km_sizes[i].ks_asked[blktype];
+			km_sizes[i].ks_allocs[blktype] = 0;
+			km_sizes[i].ks_asked[blktype] = 0;
+		}
+		if (pages[blktype] == 0 && allocs == 0) {
+			continue;
+		}
+		avg = allocs > 0 ? asked / allocs : sizes[blktype];
+		kprintf("%6u %6u %5u %6u %7u %8u %6u %5u%%\n",
+			(unsigned)sizes[blktype],
+			(unsigned)(PAGE_SIZE / sizes[blktype]),
+			(unsigned)(PAGE_SIZE % sizes[blktype]),
+			pages[blktype], inuse[blktype], allocs, avg,
+			(unsigned)((sizes[blktype] - avg) * 100 /
+				   sizes[blktype]));
+		blockbytes += inuse[blktype] * sizes[blktype];
+		wasted += inuse[blktype] * (sizes[blktype] - avg);
+	}
+	kprintf("%u bytes in blocks in use, about %u (%u%%) of them "
+		"unused\n", blockbytes, wasted,
+		blockbytes > 0 ? wasted * 100 / blockbytes : 0);
+}
+#endif
+
 void
 kheap_printstats(void)
 {
 	struct pageref *pr;
 
 	/* print the whole thing with interrupts off */
-	spinlock_acquire(&kmalloc_spinlock);
+	kmalloc_lock(KMLOCK_OTHER);
 
 	kprintf("Subpage allocator status:\n");
+#if OPT_A3
+	kprintf("(blocks held in magazines show as in use; see kmag)\n");
+#endif
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		dumpsubpage(pr);
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+#if OPT_A3
+	kheap_printfrag();
+#endif
 }
 
 ////////////////////////////////////////
@@ -378,12 +565,18 @@ static
 inline
 int blocktype(size_t sz)
 {
+#if OPT_A3
+	if (sz <= LARGEST_SUBPAGE_SIZE) {
+		return sizeclass[(sz + 7) / 8];
+	}
+#else
 	unsigned i;
 	for (i=0; i<NSIZES; i++) {
 		if (sz <= sizes[i]) {
 			return i;
 		}
 	}
+#endif
 
 	panic("Subpage allocator cannot handle allocation of size %lu\n", 
 	      (unsigned long)sz);
@@ -392,139 +585,89 @@ int blocktype(size_t sz)
 	return 0;
 }
 
+/*
+ * Take a block off PR's freelist, which must not be empty. Called
+ * with kmalloc_spinlock held.
+ */
 static
 void *
-subpage_kmalloc(size_t sz)
+subpage_pop(struct pageref *pr)
 {
-	unsigned blktype;	// index into sizes[] that we're using
-	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
-	struct freelist *volatile fl;	// free list entry
+	struct freelist *fl;	// free list entry
 	void *retptr;		// our result
 
-	volatile int i;
-
-
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
-
-		/* check for corruption */
-		KASSERT(PR_BLOCKTYPE(pr) == blktype);
-		checksubpage(pr);
-
-		if (pr->nfree > 0) {
-
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
-
-			checksubpages();
-
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
-	}
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
 
-	/*
-	 * No page of the right size available.
-	 * Make a new one.
-	 *
-	 * We release the spinlock while calling alloc_kpages. This
-	 * avoids deadlock if alloc_kpages needs to come back here.
-	 * Note that this means things can change behind our back...
-	 */
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
 
-	spinlock_release(&kmalloc_spinlock);
-	prpage = alloc_kpages(1);
-	if (prpage==0) {
-		/* Out of memory. */
-		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
-		return NULL;
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
 	}
-	spinlock_acquire(&kmalloc_spinlock);
-
-	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
 	}
 
-	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
-	pr->nfree = PAGE_SIZE / sizes[blktype];
+	return retptr;
+}
 
-	/*
-	 * Note: fl is volatile because the MIPS toolchain we were
-	 * using in spring 2001 attempted to optimize this loop and
-	 * blew it. Making fl volatile inhibits the optimization.
-	 */
+#if OPT_A3
+/*
+ * Find the pageref for the page PTRADDR is on, without the lock, from
+ * the coremap's record of it (NULL if it isn't one of ours). Returns
+ * false if we can't tell this way, because the page isn't managed by
+ * the coremap: memory stolen before it was up.
+ */
+static
+bool
+subpage_fastfind(vaddr_t ptraddr, struct pageref **ret)
+{
+	struct pageref *pr;
+	bool managed;
 
-	fla = prpage;
-	fl = (struct freelist *)fla;
-	fl->next = NULL;
-	for (i=1; i<pr->nfree; i++) {
-		fl = (struct freelist *)(fla + i*sizes[blktype]);
-		fl->next = (struct freelist *)(fla + (i-1)*sizes[blktype]);
-		KASSERT(fl != fl->next);
+	/* Our pages are all in kseg0; kseg2 only has whole pages. */
+	if (ptraddr < MIPS_KSEG0 || ptraddr >= MIPS_KSEG1) {
+		*ret = NULL;
+		return true;
 	}
-	fla = (vaddr_t) fl;
-	pr->freelist_offset = fla - prpage;
-	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
-
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
-
-	/* This is kind of cheesy, but avoids duplicating the alloc code. */
-	goto doalloc;
+	pr = coremap_kmpage(ptraddr - MIPS_KSEG0, &managed);
+	if (!managed) {
+		return false;
+	}
+	KASSERT(pr == NULL || PR_PAGEADDR(pr) == (ptraddr & PAGE_FRAME));
+	*ret = pr;
+	return true;
 }
+#endif
 
+/*
+ * Find the pageref for the page PTRADDR is on, or NULL if it isn't on
+ * one of ours. Called with kmalloc_spinlock held.
+ */
 static
-int
-subpage_kfree(void *ptr)
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
 {
-	int blktype;		// index into sizes[] that we're using
-	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
-	vaddr_t offset;		// offset into page
-
-	ptraddr = (vaddr_t)ptr;
-
-	spinlock_acquire(&kmalloc_spinlock);
+	int blktype;		// index into sizes[] that we're using
 
-	checksubpages();
+#if OPT_A3
+	if (subpage_fastfind(ptraddr, &pr)) {
+		return pr;
+	}
+#endif
 
 	for (pr = allbase; pr; pr = pr->next_all) {
 		prpage = PR_PAGEADDR(pr);
@@ -535,28 +678,32 @@ subpage_kfree(void *ptr)
 		checksubpage(pr);
 
 		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
+			return pr;
 		}
 	}
+	return NULL;
+}
 
-	if (pr==NULL) {
-		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
-		return -1;
-	}
-
-	offset = ptraddr - prpage;
-
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
-		panic("kfree: subpage free of invalid addr %p\n", ptr);
-	}
+/*
+ * Put the block at PTR back on the freelist of its page PR. If that
+ * frees the whole page, the page is dropped and its address returned,
+ * to be given to free_kpages once kmalloc_spinlock is released;
+ * otherwise returns 0. Called with kmalloc_spinlock held.
+ */
+static
+vaddr_t
+subpage_release(struct pageref *pr, void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
 
-	/*
-	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
-	 */
-	fill_deadbeef(ptr, sizes[blktype]);
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = (vaddr_t)ptr - prpage;
+	KASSERT(offset < PAGE_SIZE && offset % sizes[blktype] == 0);
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
@@ -578,45 +725,1105 @@ subpage_kfree(void *ptr)
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
 		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
-
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
-	spinlock_acquire(&kmalloc_spinlock);
-	checksubpages();
-	spinlock_release(&kmalloc_spinlock);
+#if OPT_A3
+		coremap_setkmpage(prpage - MIPS_KSEG0, NULL);
 #endif
-
+		return prpage;
+	}
 	return 0;
 }
 
+#if OPT_A3
+////////////////////////////////////////
+//
+// Per-CPU magazines.
+//
+//    Each CPU keeps, for each block size, two magazines of free blocks:
+//    "loaded", which allocations pop from and frees push onto, and
+//    "previous". A magazine is just a chain of blocks, linked through
+//    their first word, and a count. When loaded runs dry it is swapped
+//    with previous if that has anything; when it fills up, with
+//    previous if that isn't full too. Only when neither will do does a
+//    CPU take kmalloc_spinlock, to trade a whole magazine with the
+//    depot: a full one is handed in (previous, once loaded has taken
+//    its place), or taken out, and if the depot has none, one is
+//    filled from the pages' own freelists. So most allocations and
+//    frees take only their own CPU's lock, which other CPUs take only
+//    to drain it.
+//
+//    The depot keeps at most DEPOT_MAX full magazines per size; past
+//    that the blocks go back to their pages, so pages can still be
+//    freed. Everything cached is given back when memory runs out.
+//
+//    Frees find the block's page, and so its size, through the
+//    coremap without any lock (see subpage_fastfind).
 //
-////////////////////////////////////////////////////////////
 
-void *
-kmalloc(size_t sz)
-{
-	if (sz>=LARGEST_SUBPAGE_SIZE) {
-		unsigned long npages;
-		vaddr_t address;
+#define MAG_ROUNDS  16		/* blocks per magazine */
+#define DEPOT_MAX   4		/* full magazines per size in the depot */
 
-		/* Round up to a whole number of pages. */
-		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
-		address = alloc_kpages(npages);
-		if (address==0) {
-			return NULL;
-		}
+struct magazine {
+	struct freelist *mg_head;
+	unsigned mg_nrounds;
+};
 
-		return (void *)address;
-	}
+/* In the depot, a magazine's first block also links to the next one. */
+struct depotmag {
+	struct freelist dm_chain;	/* the rest of this magazine */
+	struct depotmag *dm_next;
+};
 
-	return subpage_kmalloc(sz);
-}
+/*
+ * One CPU's magazines. All zeroes is an unlocked lock and empty
+ * magazines, so no initialization is needed.
+ */
+struct kmcpu {
+	struct spinlock kc_lock;
+	struct magazine kc_loaded[NSIZES];
+	struct magazine kc_previous[NSIZES];
+	unsigned kc_allochits;		/* allocations from the magazines */
+	unsigned kc_allocmisses;	/* ...that went to the depot instead */
+	unsigned kc_freehits;		/* frees into the magazines */
+	unsigned kc_freemisses;		/* ...that sent one to the depot */
+};
+
+static struct kmcpu km_cpus[MAXCPUS];
+static volatile bool km_magazines = true;
+
+/* The depot; under kmalloc_spinlock. */
+static struct depotmag *km_depot[NSIZES];
+static unsigned km_depotcount[NSIZES];
+
+static
+void *
+magazine_pop(struct magazine *mg)
+{
+	struct freelist *fl;
+
+	KASSERT(mg->mg_nrounds > 0);
+	fl = mg->mg_head;
+	mg->mg_head = fl->next;
+	mg->mg_nrounds--;
+	return fl;
+}
+
+static
+void
+magazine_push(struct magazine *mg, void *ptr)
+{
+	struct freelist *fl = ptr;
+
+	fl->next = mg->mg_head;
+	mg->mg_head = fl;
+	mg->mg_nrounds++;
+}
+
+static
+void
+magazine_swap(struct magazine *a, struct magazine *b)
+{
+	struct magazine tmp;
+
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/*
+ * Put the blocks in MG back on their pages, leaving it empty. Called
+ * with kmalloc_spinlock held, which is dropped to free whole pages.
+ */
+static
+void
+magazine_release(struct magazine *mg)
+{
+	struct pageref *pr;
+	vaddr_t page;
+	void *ptr;
+
+	while (mg->mg_nrounds > 0) {
+		ptr = magazine_pop(mg);
+		pr = subpage_findpage((vaddr_t)ptr);
+		KASSERT(pr != NULL);
+		page = subpage_release(pr, ptr);
+		if (page != 0) {
+			spinlock_release(&kmalloc_spinlock);
+			free_kpages(page);
+			kmalloc_lock(KMLOCK_DEPOT);
+		}
+	}
+	KASSERT(mg->mg_head == NULL);
+}
+
+/*
+ * Hand MG, of size class BLKTYPE, to the depot if it is full and
+ * there is room, otherwise back to the pages. Leaves MG empty.
+ */
+static
+void
+depot_put(unsigned blktype, struct magazine *mg)
+{
+	struct depotmag *dm;
+
+	kmalloc_lock(KMLOCK_DEPOT);
+	if (mg->mg_nrounds == MAG_ROUNDS &&
+	    km_depotcount[blktype] < DEPOT_MAX) {
+		dm = (struct depotmag *)mg->mg_head;
+		dm->dm_next = km_depot[blktype];
+		km_depot[blktype] = dm;
+		km_depotcount[blktype]++;
+		mg->mg_head = NULL;
+		mg->mg_nrounds = 0;
+	}
+	else {
+		magazine_release(mg);
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Fill MG, which is empty, with blocks of size class BLKTYPE: a full
+ * magazine from the depot if there is one, otherwise as many as the
+ * pages can spare, up to MAG_ROUNDS. That may be none.
+ */
+static
+void
+depot_get(unsigned blktype, struct magazine *mg)
+{
+	struct depotmag *dm;
+	struct pageref *pr;
+
+	KASSERT(mg->mg_nrounds == 0);
+
+	kmalloc_lock(KMLOCK_DEPOT);
+	dm = km_depot[blktype];
+	if (dm != NULL) {
+		km_depot[blktype] = dm->dm_next;
+		km_depotcount[blktype]--;
+		mg->mg_head = &dm->dm_chain;
+		mg->mg_nrounds = MAG_ROUNDS;
+	}
+	else {
+		for (pr = sizebases[blktype];
+		     pr != NULL && mg->mg_nrounds < MAG_ROUNDS;
+		     pr = pr->next_samesize) {
+			while (pr->nfree > 0 && mg->mg_nrounds < MAG_ROUNDS) {
+				magazine_push(mg, subpage_pop(pr));
+			}
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Allocate a block of size class BLKTYPE from this CPU's magazines,
+ * going to the depot if they are empty. Returns NULL if there is none
+ * to be had without a new page.
+ */
+static
+void *
+magazine_get(unsigned blktype)
+{
+	struct kmcpu *kc;
+	struct magazine *ld, *pv;
+	struct magazine mg, spill;
+	void *ptr;
+
+	if (!km_magazines || !CURCPU_EXISTS()) {
+		return NULL;
+	}
+
+	/*
+	 * If we migrate after reading curcpu we just use another
+	 * CPU's magazines for once; the lock keeps that safe.
+	 */
+	kc = &km_cpus[curcpu->c_number];
+	spinlock_acquire(&kc->kc_lock);
+	ld = &kc->kc_loaded[blktype];
+	pv = &kc->kc_previous[blktype];
+	if (ld->mg_nrounds == 0 && pv->mg_nrounds > 0) {
+		magazine_swap(ld, pv);
+	}
+	if (ld->mg_nrounds > 0) {
+		ptr = magazine_pop(ld);
+		kc->kc_allochits++;
+		spinlock_release(&kc->kc_lock);
+		return ptr;
+	}
+	kc->kc_allocmisses++;
+	spinlock_release(&kc->kc_lock);
+
+	mg.mg_head = NULL;
+	mg.mg_nrounds = 0;
+	depot_get(blktype, &mg);
+	if (mg.mg_nrounds == 0) {
+		return NULL;
+	}
+	ptr = magazine_pop(&mg);
+
+	/* Keep the rest, unless frees have refilled us meanwhile. */
+	spill.mg_head = NULL;
+	spill.mg_nrounds = 0;
+	kc = &km_cpus[curcpu->c_number];
+	spinlock_acquire(&kc->kc_lock);
+	ld = &kc->kc_loaded[blktype];
+	pv = &kc->kc_previous[blktype];
+	if (ld->mg_nrounds == 0) {
+		*ld = mg;
+	}
+	else if (pv->mg_nrounds == 0) {
+		*pv = mg;
+	}
+	else {
+		spill = mg;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (spill.mg_nrounds > 0) {
+		depot_put(blktype, &spill);
+	}
+	return ptr;
+}
+
+/*
+ * Free PTR, a block of size class BLKTYPE, into this CPU's magazines.
+ * Returns false if the magazines are off.
+ */
+static
+bool
+magazine_put(unsigned blktype, void *ptr)
+{
+	struct kmcpu *kc;
+	struct magazine *ld, *pv;
+	struct magazine spill;
+
+	if (!km_magazines || !CURCPU_EXISTS()) {
+		return false;
+	}
+
+	spill.mg_head = NULL;
+	spill.mg_nrounds = 0;
+
+	kc = &km_cpus[curcpu->c_number];
+	spinlock_acquire(&kc->kc_lock);
+	ld = &kc->kc_loaded[blktype];
+	pv = &kc->kc_previous[blktype];
+	if (ld->mg_nrounds == MAG_ROUNDS) {
+		if (pv->mg_nrounds < MAG_ROUNDS) {
+			magazine_swap(ld, pv);
+		}
+		else {
+			/* both full: the older one goes */
+			spill = *pv;
+			*pv = *ld;
+			ld->mg_head = NULL;
+			ld->mg_nrounds = 0;
+		}
+	}
+	magazine_push(ld, ptr);
+	if (spill.mg_nrounds > 0) {
+		kc->kc_freemisses++;
+	}
+	else {
+		kc->kc_freehits++;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (spill.mg_nrounds > 0) {
+		depot_put(blktype, &spill);
+	}
+	return true;
+}
+
+/*
+ * Give every cached block back to its page: each CPU's magazines,
+ * then the depot. Returns how many blocks that was.
+ */
+static
+unsigned
+magazine_drainall(void)
+{
+	struct kmcpu *kc;
+	struct magazine mg[2];
+	struct depotmag *dm;
+	unsigned i, blktype, n;
+
+	n = 0;
+	for (i = 0; i < MAXCPUS; i++) {
+		kc = &km_cpus[i];
+		for (blktype = 0; blktype < NSIZES; blktype++) {
+			spinlock_acquire(&kc->kc_lock);
+			mg[0] = kc->kc_loaded[blktype];
+			mg[1] = kc->kc_previous[blktype];
+			kc->kc_loaded[blktype].mg_head = NULL;
+			kc->kc_loaded[blktype].mg_nrounds = 0;
+			kc->kc_previous[blktype].mg_head = NULL;
+			kc->kc_previous[blktype].mg_nrounds = 0;
+			spinlock_release(&kc->kc_lock);
+
+			if (mg[0].mg_nrounds + mg[1].mg_nrounds == 0) {
+				continue;
+			}
+			n += mg[0].mg_nrounds + mg[1].mg_nrounds;
+			kmalloc_lock(KMLOCK_DEPOT);
+			magazine_release(&mg[0]);
+			magazine_release(&mg[1]);
+			spinlock_release(&kmalloc_spinlock);
+		}
+	}
+
+	kmalloc_lock(KMLOCK_DEPOT);
+	for (blktype = 0; blktype < NSIZES; blktype++) {
+		while ((dm = km_depot[blktype]) != NULL) {
+			km_depot[blktype] = dm->dm_next;
+			km_depotcount[blktype]--;
+			mg[0].mg_head = &dm->dm_chain;
+			mg[0].mg_nrounds = MAG_ROUNDS;
+			n += MAG_ROUNDS;
+			magazine_release(&mg[0]);
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	return n;
+}
+
+void
+kmalloc_setmagazines(bool on)
+{
+	km_magazines = on;
+	if (!on) {
+		magazine_drainall();
+	}
+}
+
+void
+kmalloc_printmagstats(void)
+{
+	static const char *const whynames[KMLOCK_COUNT] = {
+		"alloc", "free", "depot", "other",
+	};
+	struct kmcpu *kc;
+	unsigned holds[KMLOCK_COUNT];
+	unsigned i, blktype, cached, depot;
+
+	kprintf("kmalloc magazines: %s, %u blocks each, depot of %u per "
+		"size\n", km_magazines ? "on" : "off", MAG_ROUNDS, DEPOT_MAX);
+
+	for (i = 0; i < MAXCPUS; i++) {
+		kc = &km_cpus[i];
+		spinlock_acquire(&kc->kc_lock);
+		cached = 0;
+		for (blktype = 0; blktype < NSIZES; blktype++) {
+			cached += kc->kc_loaded[blktype].mg_nrounds +
+				kc->kc_previous[blktype].mg_nrounds;
+		}
+		if (kc->kc_allochits + kc->kc_allocmisses +
+		    kc->kc_freehits + kc->kc_freemisses + cached > 0) {
+			kprintf("    cpu%u: %u cached, alloc %u hits %u misses, "
+				"free %u hits %u misses\n", i, cached,
+				kc->kc_allochits, kc->kc_allocmisses,
+				kc->kc_freehits, kc->kc_freemisses);
+		}
+		kc->kc_allochits = kc->kc_allocmisses = 0;
+		kc->kc_freehits = kc->kc_freemisses = 0;
+		spinlock_release(&kc->kc_lock);
+	}
+
+	kmalloc_lock(KMLOCK_OTHER);
+	depot = 0;
+	for (blktype = 0; blktype < NSIZES; blktype++) {
+		depot += km_depotcount[blktype];
+	}
+	for (i = 0; i < KMLOCK_COUNT; i++) {
+		holds[i] = km_lockholds[i];
+		km_lockholds[i] = 0;
+	}
+	spinlock_release(&kmalloc_spinlock);
+
+	kprintf("    depot: %u magazines\n", depot);
+	kprintf("    kmalloc_spinlock taken:");
+	for (i = 0; i < KMLOCK_COUNT; i++) {
+		kprintf(" %u %s", holds[i], whynames[i]);
+	}
+	kprintf("\n    (counters reset)\n");
+}
+#endif /* OPT_A3 */
+
+#if OPT_A3
+////////////////////////////////////////
+//
+// Allocation profiler.
+//
+//    While it is on, kmalloc records each block it hands out, with the
+//    size asked for and the address it was called from, in a hash
+//    table of live blocks keyed by the block's address; kfree takes it
+//    out again. A second, smaller table keeps totals for each caller.
+//    From these we report the callers that allocate the most bytes and
+//    the most blocks, how allocations spread over the size classes and
+//    over time, and which callers still have blocks live - leak
+//    candidates, if what they allocate during a test run should all be
+//    gone by its end.
+//
+//    Only the immediate caller is known, so blocks from kstrdup and
+//    kmem_cache_alloc are charged to those. Look the addresses up in
+//    the kernel image with addr2line.
+//
+//    Turning the profiler on starts a new run. The live table is
+//    allocated then and freed when it is turned off; blocks allocated
+//    while it was off aren't in it, and their frees are ignored.
+//
+
+#define KPROF_LIVEBITS 12
+#define KPROF_LIVE     (1 << KPROF_LIVEBITS)	/* slots for live blocks */
+#define KPROF_LIVEMAX  (KPROF_LIVE / 4 * 3)	/* most we fill */
+#define KPROF_CALLERBITS 8
+#define KPROF_CALLERS  (1 << KPROF_CALLERBITS)	/* slots for callers */
+#define KPROF_TOP      8	/* callers in each list */
+#define KPROF_SECS     32	/* seconds of history for the rates */
+#define KPROF_BAR      40	/* widest histogram bar */
+
+struct kpblock {
+	vaddr_t kpb_ptr;		/* 0 for an empty slot */
+	vaddr_t kpb_caller;
+	size_t kpb_size;		/* as asked for */
+};
+
+struct kpcaller {
+	vaddr_t kpc_caller;		/* 0 for an empty slot */
+	unsigned kpc_allocs;
+	unsigned kpc_bytes;
+	unsigned kpc_live;		/* of the tracked blocks */
+	unsigned kpc_livebytes;
+};
+
+struct kprate {
+	time_t kpr_secs;		/* which second this slot is for */
+	unsigned kpr_allocs;
+	unsigned kpr_frees;
+};
+
+static volatile bool kp_on;
+static struct kpblock *kp_live;		/* KPROF_LIVE slots, or NULL */
+static unsigned kp_nlive;
+static unsigned kp_untracked;		/* not put in the live table */
+static struct kpcaller kp_callers[KPROF_CALLERS];
+static unsigned kp_classallocs[NSIZES + 1];	/* last is whole pages */
+static struct kprate kp_rate[KPROF_SECS];
+static time_t kp_start;
+static struct spinlock kp_lock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+kprof_hash(vaddr_t addr, unsigned bits)
+{
+	/* Multiplicative hashing; the low bits are mostly alignment. */
+	return ((uint32_t)(addr >> 2) * 2654435761U) >> (32 - bits);
+}
+
+/* Find or add CALLER's totals, or NULL if the table is full. */
+static
+struct kpcaller *
+kprof_caller(vaddr_t caller)
+{
+	unsigned i, n;
+
+	i = kprof_hash(caller, KPROF_CALLERBITS);
+	for (n = 0; n < KPROF_CALLERS; n++) {
+		if (kp_callers[i].kpc_caller == caller) {
+			return &kp_callers[i];
+		}
+		if (kp_callers[i].kpc_caller == 0) {
+			kp_callers[i].kpc_caller = caller;
+			return &kp_callers[i];
+		}
+		i = (i + 1) % KPROF_CALLERS;
+	}
+	return NULL;
+}
+
+/* The slot for this second in the rate history. */
+static
+struct kprate *
+kprof_rate(time_t secs)
+{
+	struct kprate *kpr;
+
+	kpr = &kp_rate[(uint32_t)secs % KPROF_SECS];
+	if (kpr->kpr_secs != secs) {
+		kpr->kpr_secs = secs;
+		kpr->kpr_allocs = kpr->kpr_frees = 0;
+	}
+	return kpr;
+}
+
+/*
+ * Take the block in slot I out of the live table. With linear probing
+ * we can't just empty the slot: later entries that probed past it
+ * would be lost. Move back any that hashed at or before it instead.
+ */
+static
+void
+kprof_remove(unsigned i)
+{
+	unsigned j, k;
+
+	j = i;
+	while (1) {
+		j = (j + 1) % KPROF_LIVE;
+		if (kp_live[j].kpb_ptr == 0) {
+			break;
+		}
+		k = kprof_hash(kp_live[j].kpb_ptr, KPROF_LIVEBITS);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+			/* Still reachable from where it hashed. */
+			continue;
+		}
+		kp_live[i] = kp_live[j];
+		i = j;
+	}
+	kp_live[i].kpb_ptr = 0;
+	kp_nlive--;
+}
+
+/* Find the live table slot for PTR, or return KPROF_LIVE. */
+static
+unsigned
+kprof_find(vaddr_t ptr)
+{
+	unsigned i;
+
+	for (i = kprof_hash(ptr, KPROF_LIVEBITS);
+	     kp_live[i].kpb_ptr != 0;
+	     i = (i + 1) % KPROF_LIVE) {
+		if (kp_live[i].kpb_ptr == ptr) {
+			return i;
+		}
+	}
+	return KPROF_LIVE;
+}
+
+/* Forget the block in slot I, which has been freed. */
+static
+void
+kprof_forget(unsigned i)
+{
+	struct kpcaller *kpc;
+
+	kpc = kprof_caller(kp_live[i].kpb_caller);
+	KASSERT(kpc != NULL && kpc->kpc_live > 0);
+	kpc->kpc_live--;
+	kpc->kpc_livebytes -= kp_live[i].kpb_size;
+	kprof_remove(i);
+}
+
+static
+void
+kprof_alloc(void *ptr, size_t sz, void *caller)
+{
+	struct kpcaller *kpc;
+	time_t secs;
+	uint32_t nsecs;
+	unsigned i;
+
+	gettime(&secs, &nsecs);
+
+	spinlock_acquire(&kp_lock);
+	if (kp_live == NULL) {
+		/* Turned off since kmalloc looked. */
+		spinlock_release(&kp_lock);
+		return;
+	}
+	kprof_rate(secs)->kpr_allocs++;
+	kp_classallocs[sz >= LARGEST_SUBPAGE_SIZE ? NSIZES : blocktype(sz)]++;
+
+	kpc = kprof_caller((vaddr_t)caller);
+	if (kpc == NULL) {
+		kp_untracked++;
+		spinlock_release(&kp_lock);
+		return;
+	}
+	kpc->kpc_allocs++;
+	kpc->kpc_bytes += sz;
+	if (kp_nlive >= KPROF_LIVEMAX) {
+		/* Still counted above; just not followed to its kfree. */
+		kp_untracked++;
+		spinlock_release(&kp_lock);
+		return;
+	}
+
+	/* Freed without us seeing it? Then it isn't live any more. */
+	i = kprof_find((vaddr_t)ptr);
+	if (i < KPROF_LIVE) {
+		kprof_forget(i);
+	}
+
+	i = kprof_hash((vaddr_t)ptr, KPROF_LIVEBITS);
+	while (kp_live[i].kpb_ptr != 0) {
+		i = (i + 1) % KPROF_LIVE;
+	}
+	kp_live[i].kpb_ptr = (vaddr_t)ptr;
+	kp_live[i].kpb_caller = (vaddr_t)caller;
+	kp_live[i].kpb_size = sz;
+	kp_nlive++;
+	kpc->kpc_live++;
+	kpc->kpc_livebytes += sz;
+	spinlock_release(&kp_lock);
+}
+
+static
+void
+kprof_free(void *ptr)
+{
+	time_t secs;
+	uint32_t nsecs;
+	unsigned i;
+
+	gettime(&secs, &nsecs);
+
+	spinlock_acquire(&kp_lock);
+	if (kp_live != NULL) {
+		i = kprof_find((vaddr_t)ptr);
+		if (i < KPROF_LIVE) {
+			kprof_rate(secs)->kpr_frees++;
+			kprof_forget(i);
+		}
+	}
+	spinlock_release(&kp_lock);
+}
+
+int
+kmalloc_setprofiling(bool on)
+{
+	struct kpblock *live, *old;
+	time_t secs;
+	uint32_t nsecs;
+
+	live = NULL;
+	if (on) {
+		live = kmalloc(KPROF_LIVE * sizeof(*live));
+		if (live == NULL) {
+			return ENOMEM;
+		}
+		bzero(live, KPROF_LIVE * sizeof(*live));
+	}
+	gettime(&secs, &nsecs);
+
+	spinlock_acquire(&kp_lock);
+	old = kp_live;
+	kp_live = live;
+	if (on) {
+		/* A new run. */
+		kp_nlive = 0;
+		kp_untracked = 0;
+		bzero(kp_callers, sizeof(kp_callers));
+		bzero(kp_classallocs, sizeof(kp_classallocs));
+		bzero(kp_rate, sizeof(kp_rate));
+		kp_start = secs;
+	}
+	kp_on = on;
+	spinlock_release(&kp_lock);
+
+	kfree(old);
+	return 0;
+}
+
+static
+unsigned
+kprof_bybytes(const struct kpcaller *kpc)
+{
+	return kpc->kpc_bytes;
+}
+
+static
+unsigned
+kprof_bycount(const struct kpcaller *kpc)
+{
+	return kpc->kpc_allocs;
+}
+
+static
+unsigned
+kprof_bylive(const struct kpcaller *kpc)
+{
+	return kpc->kpc_livebytes;
+}
+
+/* Print the KPROF_TOP callers with the largest nonzero KEY. */
+static
+void
+kprof_printtop(const char *title, unsigned (*key)(const struct kpcaller *))
+{
+	bool picked[KPROF_CALLERS];
+	struct kpcaller *kpc;
+	unsigned i, n, best, bestkey;
+
+	kprintf("%s:\n", title);
+	bzero(picked, sizeof(picked));
+	for (n = 0; n < KPROF_TOP; n++) {
+		best = KPROF_CALLERS;
+		bestkey = 0;
+		for (i = 0; i < KPROF_CALLERS; i++) {
+			if (!picked[i] && kp_callers[i].kpc_caller != 0 &&
+			    key(&kp_callers[i]) > bestkey) {
+				best = i;
+				bestkey = key(&kp_callers[i]);
+			}
+		}
+		if (best == KPROF_CALLERS) {
+			break;
+		}
+		picked[best] = true;
+		kpc = &kp_callers[best];
+		kprintf("    0x%08x %8u allocs %10u bytes, %u live "
+			"(%u bytes)\n", kpc->kpc_caller, kpc->kpc_allocs,
+			kpc->kpc_bytes, kpc->kpc_live, kpc->kpc_livebytes);
+	}
+	if (n == 0) {
+		kprintf("    (none)\n");
+	}
+}
+
+static
+void
+kprof_printbar(unsigned val, unsigned max)
+{
+	unsigned i, len;
+
+	len = max ? (val * KPROF_BAR + max - 1) / max : 0;
+	for (i = 0; i < len; i++) {
+		kprintf("#");
+	}
+	kprintf("\n");
+}
+
+void
+kmalloc_printprofile(void)
+{
+	struct kprate *kpr;
+	time_t secs, s;
+	uint32_t nsecs;
+	unsigned i, max, allocs, frees;
+
+	gettime(&secs, &nsecs);
+
+	spinlock_acquire(&kp_lock);
+	kprintf("kmalloc profiler: %s, %u blocks live, %u allocations "
+		"not in the live table\n", kp_on ? "on" : "off", kp_nlive,
+		kp_untracked);
+
+	kprof_printtop("Top callers by bytes", kprof_bybytes);
+	kprof_printtop("Top callers by count", kprof_bycount);
+
+	kprintf("Allocations by size:\n");
+	max = 0;
+	for (i = 0; i <= NSIZES; i++) {
+		if (kp_classallocs[i] > max) {
+			max = kp_classallocs[i];
+		}
+	}
+	for (i = 0; i <= NSIZES; i++) {
+		if (i < NSIZES) {
+			kprintf("    %6u %8u ", (unsigned)sizes[i],
+				kp_classallocs[i]);
+		}
+		else {
+			kprintf("     pages %8u ", kp_classallocs[i]);
+		}
+		kprof_printbar(kp_classallocs[i], max);
+	}
+
+	if (kp_on) {
+		kprintf("Allocations (and frees) per second:\n");
+		max = 0;
+		for (i = 0; i < KPROF_SECS; i++) {
+			if (kp_rate[i].kpr_allocs > max) {
+				max = kp_rate[i].kpr_allocs;
+			}
+		}
+		s = secs - KPROF_SECS + 1;
+		if (s < kp_start) {
+			s = kp_start;
+		}
+		for (; s <= secs; s++) {
+			kpr = &kp_rate[(uint32_t)s % KPROF_SECS];
+			allocs = kpr->kpr_secs == s ? kpr->kpr_allocs : 0;
+			frees = kpr->kpr_secs == s ? kpr->kpr_frees : 0;
+			kprintf("    %4ds %7u (%7u) ", (int)(s - secs), allocs,
+				frees);
+			kprof_printbar(allocs, max);
+		}
+	}
+
+	kprof_printtop("Leak candidates (callers with blocks still live)",
+		       kprof_bylive);
+	spinlock_release(&kp_lock);
+}
+#endif /* OPT_A3 */
+
+static
+void *
+subpage_kmalloc(size_t sz)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	struct pageref *pr;	// pageref for page we're allocating from
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *volatile fl;	// free list entry
+	void *retptr;		// our result
+
+	volatile int i;
+
+
+	blktype = blocktype(sz);
+#if OPT_A3
+	kmalloc_countsize(blktype, sz);
+#endif
+	sz = sizes[blktype];
+
+#if OPT_A3
+	retptr = magazine_get(blktype);
+	if (retptr != NULL) {
+		return retptr;
+	}
+#endif
+
+	kmalloc_lock(KMLOCK_ALLOC);
+
+	checksubpages();
+
+	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+
+		if (pr->nfree > 0) {
+
+		doalloc: /* comes here after getting a whole fresh page */
+
+			retptr = subpage_pop(pr);
+
+			checksubpages();
+
+			spinlock_release(&kmalloc_spinlock);
+			return retptr;
+		}
+	}
+
+	/*
+	 * No page of the right size available.
+	 * Make a new one.
+	 *
+	 * We release the spinlock while calling alloc_kpages. This
+	 * avoids deadlock if alloc_kpages needs to come back here.
+	 * Note that this means things can change behind our back...
+	 */
+
+	spinlock_release(&kmalloc_spinlock);
+	prpage = alloc_kpages(1);
+	if (prpage==0) {
+		/* Out of memory. */
+		kprintf("kmalloc: Subpage allocator couldn't get a page\n"); 
+		return NULL;
+	}
+	kmalloc_lock(KMLOCK_ALLOC);
+
+	pr = allocpageref();
+	if (pr==NULL) {
+		/* Couldn't allocate accounting space for the new page. */
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(prpage);
+		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+		return NULL;
+	}
+
+	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
+	pr->nfree = PAGE_SIZE / sizes[blktype];
+
+	/*
+	 * Note: fl is volatile because the MIPS toolchain we were
+	 * using in spring 2001 attempted to optimize this loop and
+	 * blew it. Making fl volatile inhibits the optimization.
+	 */
+
+	fla = prpage;
+	fl = (struct freelist *)fla;
+	fl->next = NULL;
+	for (i=1; i<pr->nfree; i++) {
+		fl = (struct freelist *)(fla + i*sizes[blktype]);
+		fl->next = (struct freelist *)(fla + (i-1)*sizes[blktype]);
+		KASSERT(fl != fl->next);
+	}
+	fla = (vaddr_t) fl;
+	pr->freelist_offset = fla - prpage;
+	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
+
+	pr->next_samesize = sizebases[blktype];
+	sizebases[blktype] = pr;
+
+	pr->next_all = allbase;
+	allbase = pr;
+
+#if OPT_A3
+	/* So kfree can find it; see subpage_fastfind. */
+	coremap_setkmpage(prpage - MIPS_KSEG0, pr);
+#endif
+
+	/* This is kind of cheesy, but avoids duplicating the alloc code. */
+	goto doalloc;
+}
+
+static
+int
+subpage_kfree(void *ptr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t ptraddr;	// same as ptr
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t offset;		// offset into page
+
+	ptraddr = (vaddr_t)ptr;
+
+#if OPT_A3
+	if (!subpage_fastfind(ptraddr, &pr)) {
+		kmalloc_lock(KMLOCK_FREE);
+		pr = subpage_findpage(ptraddr);
+		spinlock_release(&kmalloc_spinlock);
+	}
+	if (pr==NULL) {
+		/* Not on any of our pages - not a subpage allocation */
+		return -1;
+	}
+#else
+	kmalloc_lock(KMLOCK_FREE);
+
+	checksubpages();
+
+	pr = subpage_findpage(ptraddr);
+	if (pr==NULL) {
+		/* Not on any of our pages - not a subpage allocation */
+		spinlock_release(&kmalloc_spinlock);
+		return -1;
+	}
+#endif
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+
+	/*
+	 * Check for proper positioning and alignment. (Sizes that don't
+	 * divide the page leave a tail that holds no block.)
+	 */
+	if (offset >= PAGE_SIZE - PAGE_SIZE % sizes[blktype] ||
+	    offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#if OPT_A3
+	/*
+	 * The block is still allocated, so its page can't go away and
+	 * we don't need the lock yet.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+	if (magazine_put(blktype, ptr)) {
+		return 0;
+	}
+	kmalloc_lock(KMLOCK_FREE);
+	checksubpages();
+#else
+	/*
+	 * Clear the block to 0xdeadbeef to make it easier to detect
+	 * uses of dangling pointers.
+	 */
+	fill_deadbeef(ptr, sizes[blktype]);
+#endif
+
+	prpage = subpage_release(pr, ptr);
+	/* Call free_kpages without kmalloc_spinlock. */
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
+		free_kpages(prpage);
+	}
+
+#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
+	kmalloc_lock(KMLOCK_OTHER);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+
+	return 0;
+}
+
+//
+////////////////////////////////////////////////////////////
+
+#if OPT_A3
+/*
+ * Give back memory held in caches above us when we run out. Objects
+ * freed from the object caches land in the magazines, so those go
+ * first. Returns how much was freed; nonzero means it's worth trying
+ * again.
+ */
+static
+unsigned
+kmalloc_reclaim(void)
+{
+	unsigned n;
+
+	n = kmem_cache_reap();
+	return n + magazine_drainall();
+}
+#endif
+
+void *
+kmalloc(size_t sz)
+{
+#if OPT_A3
+	void *ptr;
+#endif
+
+	if (sz>=LARGEST_SUBPAGE_SIZE) {
+		unsigned long npages;
+		vaddr_t address;
+
+		/* Round up to a whole number of pages. */
+		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
+		address = alloc_kpages(npages);
+#if OPT_A3
+		/* Pages may be tied up in the caches. */
+		if (address==0 && kmalloc_reclaim() > 0) {
+			address = alloc_kpages(npages);
+		}
+#endif
+		if (address==0) {
+			return NULL;
+		}
+
+#if OPT_A3
+		if (kp_on) {
+			kprof_alloc((void *)address, sz,
+				    __builtin_return_address(0));
+		}
+#endif
+		return (void *)address;
+	}
+
+#if OPT_A3
+	ptr = subpage_kmalloc(sz);
+	if (ptr == NULL && kmalloc_reclaim() > 0) {
+		ptr = subpage_kmalloc(sz);
+	}
+	if (ptr != NULL && kp_on) {
+		kprof_alloc(ptr, sz, __builtin_return_address(0));
+	}
+	return ptr;
+#else
+	return subpage_kmalloc(sz);
+#endif
+}
 
 void
 kfree(void *ptr)
@@ -626,7 +1833,13 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_A3
+	if (kp_on) {
+		kprof_free(ptr);
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,229 @@
+/*
+ * Object caches on top of kmalloc. See kmem_cache.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+struct kmem_cache {
+	const char *kmc_name;
+	size_t kmc_size;
+	int (*kmc_ctor)(void *obj);
+	void (*kmc_dtor)(void *obj);
+	struct kmem_cache *kmc_next;	/* on kmc_all */
+
+	struct spinlock kmc_lock;	/* for everything below */
+	void *kmc_free[KMC_MAXFREE];	/* constructed, ready to hand out */
+	unsigned kmc_nfree;
+	unsigned kmc_maxfree;		/* how much of kmc_free we use */
+
+	/* Counters. */
+	unsigned kmc_live;		/* objects handed out now */
+	unsigned kmc_peak;		/* most ever handed out at once */
+	unsigned kmc_allocs;		/* kmem_cache_alloc calls */
+	unsigned kmc_hits;		/* ...served from kmc_free */
+	unsigned kmc_fails;		/* ...that returned NULL */
+	unsigned kmc_ctors;		/* objects constructed */
+	unsigned kmc_dtors;		/* objects destroyed */
+};
+
+static struct kmem_cache *kmc_all;
+static struct spinlock kmc_listlock = SPINLOCK_INITIALIZER;
+
+/* Destroy and free an object that isn't on its cache any more. */
+static
+void
+kmc_release(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kmc_dtor != NULL) {
+		kc->kmc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+/*
+ * Take every free object off KC and free them. Returns how many.
+ */
+static
+unsigned
+kmc_drain(struct kmem_cache *kc)
+{
+	void *objs[KMC_MAXFREE];
+	unsigned i, n;
+
+	spinlock_acquire(&kc->kmc_lock);
+	n = kc->kmc_nfree;
+	for (i = 0; i < n; i++) {
+		objs[i] = kc->kmc_free[i];
+	}
+	kc->kmc_nfree = 0;
+	kc->kmc_dtors += n;
+	spinlock_release(&kc->kmc_lock);
+
+	for (i = 0; i < n; i++) {
+		kmc_release(kc, objs[i]);
+	}
+	return n;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kmc_name = name;
+	kc->kmc_size = size;
+	kc->kmc_ctor = ctor;
+	kc->kmc_dtor = dtor;
+	spinlock_init(&kc->kmc_lock);
+	kc->kmc_nfree = 0;
+
+	/* Don't sit on too much memory for big objects. */
+	kc->kmc_maxfree = KMC_FREEBYTES / size;
+	if (kc->kmc_maxfree < KMC_MINFREE) {
+		kc->kmc_maxfree = KMC_MINFREE;
+	}
+	if (kc->kmc_maxfree > KMC_MAXFREE) {
+		kc->kmc_maxfree = KMC_MAXFREE;
+	}
+
+	kc->kmc_live = kc->kmc_peak = 0;
+	kc->kmc_allocs = kc->kmc_hits = kc->kmc_fails = 0;
+	kc->kmc_ctors = kc->kmc_dtors = 0;
+
+	spinlock_acquire(&kmc_listlock);
+	kc->kmc_next = kmc_all;
+	kmc_all = kc;
+	spinlock_release(&kmc_listlock);
+
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **p;
+
+	KASSERT(kc->kmc_live == 0);
+
+	spinlock_acquire(&kmc_listlock);
+	for (p = &kmc_all; *p != kc; p = &(*p)->kmc_next) {
+		KASSERT(*p != NULL);
+	}
+	*p = kc->kmc_next;
+	spinlock_release(&kmc_listlock);
+
+	kmc_drain(kc);
+	spinlock_cleanup(&kc->kmc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	spinlock_acquire(&kc->kmc_lock);
+	kc->kmc_allocs++;
+	if (kc->kmc_nfree > 0) {
+		obj = kc->kmc_free[--kc->kmc_nfree];
+		kc->kmc_hits++;
+		goto done;
+	}
+	spinlock_release(&kc->kmc_lock);
+
+	/* Make a new one, without the lock: the constructor may sleep. */
+	obj = kmalloc(kc->kmc_size);
+	if (obj != NULL && kc->kmc_ctor != NULL && kc->kmc_ctor(obj)) {
+		kfree(obj);
+		obj = NULL;
+	}
+
+	spinlock_acquire(&kc->kmc_lock);
+	if (obj == NULL) {
+		kc->kmc_fails++;
+		spinlock_release(&kc->kmc_lock);
+		return NULL;
+	}
+	kc->kmc_ctors++;
+
+ done:
+	kc->kmc_live++;
+	if (kc->kmc_live > kc->kmc_peak) {
+		kc->kmc_peak = kc->kmc_live;
+	}
+	spinlock_release(&kc->kmc_lock);
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kmc_lock);
+	KASSERT(kc->kmc_live > 0);
+	kc->kmc_live--;
+	if (kc->kmc_nfree < kc->kmc_maxfree) {
+		kc->kmc_free[kc->kmc_nfree++] = obj;
+		spinlock_release(&kc->kmc_lock);
+		return;
+	}
+	kc->kmc_dtors++;
+	spinlock_release(&kc->kmc_lock);
+
+	kmc_release(kc, obj);
+}
+
+/*
+ * Caches are only removed from kmc_all by kmem_cache_destroy, which
+ * waits for kmc_listlock, so we can drain them with it held.
+ */
+unsigned
+kmem_cache_reap(void)
+{
+	struct kmem_cache *kc;
+	unsigned n;
+
+	n = 0;
+	spinlock_acquire(&kmc_listlock);
+	for (kc = kmc_all; kc != NULL; kc = kc->kmc_next) {
+		n += kmc_drain(kc);
+	}
+	spinlock_release(&kmc_listlock);
+	return n;
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	kprintf("%-16s %5s %5s %5s %5s %8s %5s %6s %6s\n", "cache", "size",
+		"live", "peak", "free", "allocs", "hit%", "ctors", "dtors");
+
+	spinlock_acquire(&kmc_listlock);
+	for (kc = kmc_all; kc != NULL; kc = kc->kmc_next) {
+		spinlock_acquire(&kc->kmc_lock);
+		kprintf("%-16s %5u %5u %5u %5u %8u %5u %6u %6u\n",
+			kc->kmc_name, (unsigned)kc->kmc_size, kc->kmc_live,
+			kc->kmc_peak, kc->kmc_nfree, kc->kmc_allocs,
+			kc->kmc_allocs ? kc->kmc_hits * 100 / kc->kmc_allocs
+			: 0, kc->kmc_ctors, kc->kmc_dtors);
+		if (kc->kmc_fails > 0) {
+			kprintf("    %u failed\n", kc->kmc_fails);
+		}
+		spinlock_release(&kc->kmc_lock);
+	}
+	spinlock_release(&kmc_listlock);
+}
@@ -0,0 +1,307 @@
+/*
+ * Kernel virtual memory in kseg2. See kseg2.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <mips/tlb.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <vmtlb.h>
+#include <kseg2.h>
+
+/* Software bits in a kernel PTE, below the hardware ones. */
+#define KPTE_LAST      0x00000001   /* last page of an allocation */
+#define KPTE_STALE     0x00000002   /* freed; kept until the next purge */
+#define KPTE_PURGING   0x00000004   /* being released by kseg2_purge */
+
+#define KSEG2_VADDR(i)   (MIPS_KSEG2 + (vaddr_t)(i) * PAGE_SIZE)
+#define KSEG2_INDEX(va)  (((va) - MIPS_KSEG2) / PAGE_SIZE)
+
+/*
+ * A page's bit in kseg2_map is set while its address is taken:
+ * allocated, guard page, or freed but not yet purged. kseg2_ptes is
+ * read by kseg2_fault without the lock; a PTE is only made valid
+ * before its address is handed out, and an address is only reused
+ * after its PTE has been invalid through a purge.
+ */
+static pte_t *kseg2_ptes;
+static struct bitmap *kseg2_map;
+static struct spinlock kseg2_lock = SPINLOCK_INITIALIZER;
+static unsigned kseg2_hint;		/* where the next search starts */
+static bool kseg2_purging;		/* someone is in kseg2_purge */
+
+/* Counters, under kseg2_lock. */
+static unsigned kseg2_inuse;		/* pages mapped */
+static unsigned kseg2_stale;		/* addresses waiting for a purge */
+static unsigned kseg2_allocs, kseg2_purges;
+
+void
+kseg2_bootstrap(void)
+{
+	vaddr_t ptes;
+	unsigned i;
+
+	/* kseg2_fault can't take a fault on its own table. */
+	ptes = alloc_kpages(DIVROUNDUP(KSEG2_PAGES * sizeof(pte_t),
+				       PAGE_SIZE));
+	kseg2_map = bitmap_create(KSEG2_PAGES);
+	if (ptes == 0 || kseg2_map == NULL) {
+		panic("kseg2: out of memory\n");
+	}
+	KASSERT(ptes >= MIPS_KSEG0 && ptes < MIPS_KSEG1);
+
+	for (i = 0; i < KSEG2_PAGES; i++) {
+		((pte_t *)ptes)[i] = 0;
+	}
+	kseg2_ptes = (pte_t *)ptes;
+}
+
+bool
+kseg2_owns(vaddr_t vaddr)
+{
+	return vaddr >= MIPS_KSEG2 && vaddr < KSEG2_VADDR(KSEG2_PAGES);
+}
+
+/*
+ * Find NPAGES free addresses in a row, first fit starting from the
+ * hint and then from the bottom. Called with kseg2_lock held.
+ */
+static
+bool
+kseg2_findrange(unsigned npages, unsigned *start)
+{
+	unsigned i, run, pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		run = 0;
+		for (i = pass == 0 ? kseg2_hint : 0; i < KSEG2_PAGES; i++) {
+			if (bitmap_isset(kseg2_map, i)) {
+				run = 0;
+				continue;
+			}
+			if (++run == npages) {
+				*start = i + 1 - npages;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * Release everything freed so far, once no CPU's TLB can still map
+ * it: mark what is to go, flush the TLB on every CPU, then free the
+ * frames and addresses. Pages freed meanwhile wait for the next
+ * round. We have to wait for the other CPUs, so this is only possible
+ * with interrupts on; returns false if it can't be done now or there
+ * was nothing to do.
+ */
+static
+bool
+kseg2_purge(void)
+{
+	struct cpu *c;
+	unsigned i, n;
+	pte_t pte;
+
+	if (curthread == NULL || curthread->t_in_interrupt ||
+	    curthread->t_curspl != 0) {
+		return false;
+	}
+
+	spinlock_acquire(&kseg2_lock);
+	if (kseg2_purging || kseg2_stale == 0) {
+		spinlock_release(&kseg2_lock);
+		return false;
+	}
+	kseg2_purging = true;
+	for (i = 0; i < KSEG2_PAGES; i++) {
+		if (kseg2_ptes[i] & KPTE_STALE) {
+			kseg2_ptes[i] = (kseg2_ptes[i] & ~KPTE_STALE) |
+				KPTE_PURGING;
+		}
+	}
+	spinlock_release(&kseg2_lock);
+
+	/*
+	 * One full flush each covers all of them. We can be moved to
+	 * another CPU at any point in here, so rather than flushing
+	 * "this" CPU directly, every CPU, ours included, gets the IPI;
+	 * waiting on whichever CPU we are on just takes it here.
+	 */
+	for (i = 0; (c = cpu_bynumber(i)) != NULL; i++) {
+		ipi_tlbshootdown_batch(c, NULL, 0);
+	}
+	for (i = 0; (c = cpu_bynumber(i)) != NULL; i++) {
+		ipi_tlbshootdown_wait(c);
+	}
+
+	n = 0;
+	spinlock_acquire(&kseg2_lock);
+	for (i = 0; i < KSEG2_PAGES; i++) {
+		pte = kseg2_ptes[i];
+		if (!(pte & KPTE_PURGING)) {
+			continue;
+		}
+		kseg2_ptes[i] = 0;
+		bitmap_unmark(kseg2_map, i);
+		n++;
+		/* Guard pages have no frame. */
+		if (pte & PTE_FRAME) {
+			spinlock_release(&kseg2_lock);
+			free_kpages(PADDR_TO_KVADDR(pte & PTE_FRAME));
+			spinlock_acquire(&kseg2_lock);
+		}
+	}
+	kseg2_stale -= n;
+	kseg2_purges++;
+	kseg2_purging = false;
+	spinlock_release(&kseg2_lock);
+
+	return true;
+}
+
+vaddr_t
+kseg2_alloc(unsigned npages)
+{
+	vaddr_t frame;
+	unsigned start, i, j;
+	bool purged;
+
+	if (kseg2_ptes == NULL || npages == 0 || npages >= KSEG2_PAGES) {
+		return 0;
+	}
+
+	/* Take the addresses, and one more for the guard page. */
+	purged = false;
+	while (1) {
+		spinlock_acquire(&kseg2_lock);
+		if (kseg2_findrange(npages + 1, &start)) {
+			break;
+		}
+		spinlock_release(&kseg2_lock);
+		if (purged || !kseg2_purge()) {
+			return 0;
+		}
+		purged = true;
+	}
+	for (i = start; i < start + npages + 1; i++) {
+		bitmap_mark(kseg2_map, i);
+	}
+	kseg2_hint = start + npages + 1;
+	spinlock_release(&kseg2_lock);
+
+	/* Getting frames may mean paging out, so not under the lock. */
+	for (i = 0; i < npages; i++) {
+		frame = alloc_kpages(1);
+		if (frame == 0 && !purged && kseg2_purge()) {
+			/* what we were holding on to may be enough */
+			purged = true;
+			frame = alloc_kpages(1);
+		}
+		if (frame == 0) {
+			goto fail;
+		}
+		kseg2_ptes[start + i] = (frame - MIPS_KSEG0) | TLBLO_GLOBAL |
+			PTE_VALID | PTE_DIRTY;
+	}
+	kseg2_ptes[start + npages - 1] |= KPTE_LAST;
+
+	spinlock_acquire(&kseg2_lock);
+	kseg2_inuse += npages;
+	kseg2_allocs++;
+	spinlock_release(&kseg2_lock);
+
+	return KSEG2_VADDR(start);
+
+ fail:
+	/* Never handed out, so never in any TLB. */
+	for (j = 0; j < i; j++) {
+		free_kpages(PADDR_TO_KVADDR(kseg2_ptes[start + j] & PTE_FRAME));
+		kseg2_ptes[start + j] = 0;
+	}
+	spinlock_acquire(&kseg2_lock);
+	for (j = start; j < start + npages + 1; j++) {
+		bitmap_unmark(kseg2_map, j);
+	}
+	spinlock_release(&kseg2_lock);
+	return 0;
+}
+
+void
+kseg2_free(vaddr_t vaddr)
+{
+	unsigned i, n;
+	pte_t pte;
+	bool purge;
+
+	KASSERT(kseg2_owns(vaddr));
+	KASSERT(vaddr % PAGE_SIZE == 0);
+
+	spinlock_acquire(&kseg2_lock);
+	i = KSEG2_INDEX(vaddr);
+	n = 0;
+	do {
+		pte = kseg2_ptes[i];
+		if (!(pte & PTE_VALID)) {
+			panic("kseg2_free: 0x%x is not allocated\n", vaddr);
+		}
+		kseg2_ptes[i++] = (pte & PTE_FRAME) | KPTE_STALE;
+		n++;
+	} while (!(pte & KPTE_LAST));
+	kseg2_ptes[i] = KPTE_STALE;	/* the guard page */
+
+	kseg2_inuse -= n;
+	kseg2_stale += n + 1;
+	purge = kseg2_stale >= KSEG2_PURGE_PAGES;
+	spinlock_release(&kseg2_lock);
+
+	/* Ours can go now; other CPUs' wait for the purge. */
+	for (i = 0; i < n; i++) {
+		vmtlb_drop(vaddr + i * PAGE_SIZE);
+	}
+	if (purge) {
+		kseg2_purge();
+	}
+}
+
+int
+kseg2_fault(vaddr_t vaddr)
+{
+	pte_t pte;
+
+	if (kseg2_ptes == NULL || !kseg2_owns(vaddr)) {
+		return EFAULT;
+	}
+	pte = kseg2_ptes[KSEG2_INDEX(vaddr)];
+	if (!(pte & PTE_VALID)) {
+		return EFAULT;
+	}
+	vmtlb_load(vaddr & PAGE_FRAME,
+		   pte & (PTE_FRAME | TLBLO_GLOBAL | PTE_VALID | PTE_DIRTY));
+	return 0;
+}
+
+void
+kseg2_printstats(void)
+{
+	unsigned inuse, stale, allocs, purges;
+
+	spinlock_acquire(&kseg2_lock);
+	inuse = kseg2_inuse;
+	stale = kseg2_stale;
+	allocs = kseg2_allocs;
+	purges = kseg2_purges;
+	spinlock_release(&kseg2_lock);
+
+	kprintf("kseg2: %u of %u pages mapped, %u freed awaiting a purge, "
+		"%u allocations, %u purges\n", inuse, KSEG2_PAGES, stale,
+		allocs, purges);
+}
@@ -0,0 +1,83 @@
+/*
+ * Two-level user page tables. See pagetable.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	pt = kmalloc(sizeof(struct pagetable));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < PT_DIR_ENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	KASSERT(pt != NULL);
+	for (i = 0; i < PT_DIR_ENTRIES; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *table;
+
+	KASSERT(vaddr < USERSPACETOP);
+
+	table = pt->pt_dir[PT_DIR_INDEX(vaddr)];
+	if (table == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		table = kmalloc(PAGE_SIZE);
+		if (table == NULL) {
+			return NULL;
+		}
+		bzero(table, PAGE_SIZE);
+		pt->pt_dir[PT_DIR_INDEX(vaddr)] = table;
+	}
+	return &table[PT_TABLE_INDEX(vaddr)];
+}
+
+pte_t *
+pt_next(struct pagetable *pt, vaddr_t *vaddr)
+{
+	vaddr_t va;
+	pte_t *table;
+
+	va = *vaddr & PAGE_FRAME;
+	while (va < USERSPACETOP) {
+		table = pt->pt_dir[PT_DIR_INDEX(va)];
+		if (table == NULL) {
+			/* skip to the start of the next table */
+			va = (PT_DIR_INDEX(va) + 1) * PT_TABLE_SPAN;
+			continue;
+		}
+		if (table[PT_TABLE_INDEX(va)] != 0) {
+			*vaddr = va;
+			return &table[PT_TABLE_INDEX(va)];
+		}
+		va += PAGE_SIZE;
+	}
+	return NULL;
+}
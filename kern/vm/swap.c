@@ -0,0 +1,208 @@
+/*
+ * Swap space on a dedicated disk. See swap.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vfs.h>
+#include <vm.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;		/* one bit per slot, set if in use */
+static unsigned swap_nslots;
+static unsigned swap_inuse;
+
+/* Protects swap_map and swap_inuse. The device does its own locking. */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	int result;
+
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: %s: %s; paging disabled\n", SWAP_DEVICE,
+			strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result == 0 && st.st_size < PAGE_SIZE) {
+		result = ENOSPC;
+	}
+	if (result == 0) {
+		swap_nslots = st.st_size / PAGE_SIZE;
+		swap_map = bitmap_create(swap_nslots);
+		if (swap_map == NULL) {
+			result = ENOMEM;
+		}
+	}
+	if (result) {
+		kprintf("swap: %s: %s; paging disabled\n", SWAP_DEVICE,
+			strerror(result));
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	kprintf("swap: %uk on %s\n", swap_nslots * PAGE_SIZE / 1024,
+		SWAP_DEVICE);
+}
+
+bool
+swap_enabled(void)
+{
+	return swap_vnode != NULL;
+}
+
+int
+swap_alloc(unsigned nslots, unsigned *slot)
+{
+	unsigned start, len, i;
+
+	KASSERT(swap_enabled());
+	KASSERT(nslots > 0);
+
+	spinlock_acquire(&swap_lock);
+
+	if (nslots == 1) {
+		if (bitmap_alloc(swap_map, slot)) {
+			spinlock_release(&swap_lock);
+			return ENOSPC;
+		}
+		swap_inuse++;
+		spinlock_release(&swap_lock);
+		return 0;
+	}
+
+	/* First fit for a run of free slots. */
+	len = 0;
+	for (start = i = 0; i < swap_nslots; i++) {
+		if (bitmap_isset(swap_map, i)) {
+			len = 0;
+			start = i + 1;
+			continue;
+		}
+		if (++len == nslots) {
+			break;
+		}
+	}
+	if (len < nslots) {
+		spinlock_release(&swap_lock);
+		return ENOSPC;
+	}
+	for (i = start; i < start + nslots; i++) {
+		bitmap_mark(swap_map, i);
+	}
+	swap_inuse += nslots;
+
+	spinlock_release(&swap_lock);
+
+	*slot = start;
+	return 0;
+}
+
+void
+swap_free(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(bitmap_isset(swap_map, slot));
+	bitmap_unmark(swap_map, slot);
+	swap_inuse--;
+	spinlock_release(&swap_lock);
+}
+
+int
+swap_read(unsigned slot, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio u;
+	int result;
+
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	return 0;
+}
+
+int
+swap_write(unsigned slot, const paddr_t *paddrs, unsigned npages)
+{
+	struct iovec iov[SWAP_CLUSTER];
+	struct uio u;
+	unsigned i;
+	int result;
+
+	KASSERT(npages > 0 && npages <= SWAP_CLUSTER);
+	KASSERT(slot + npages <= swap_nslots);
+
+	for (i = 0; i < npages; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	u.uio_iov = iov;
+	u.uio_iovcnt = npages;
+	u.uio_offset = (off_t)slot * PAGE_SIZE;
+	u.uio_resid = npages * PAGE_SIZE;
+	u.uio_segflg = UIO_SYSSPACE;
+	u.uio_rw = UIO_WRITE;
+	u.uio_space = NULL;
+
+	result = VOP_WRITE(swap_vnode, &u);
+	if (result) {
+		return result;
+	}
+	if (u.uio_resid != 0) {
+		return EIO;
+	}
+
+	for (i = 0; i < npages; i++) {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+	return 0;
+}
+
+void
+swap_printstats(void)
+{
+	unsigned inuse;
+
+	if (!swap_enabled()) {
+		kprintf("Swap: none\n");
+		return;
+	}
+
+	spinlock_acquire(&swap_lock);
+	inuse = swap_inuse;
+	spinlock_release(&swap_lock);
+
+	kprintf("Swap: %u of %u slots in use (%uk of %uk)\n", inuse,
+		swap_nslots, inuse * PAGE_SIZE / 1024,
+		swap_nslots * PAGE_SIZE / 1024);
+}
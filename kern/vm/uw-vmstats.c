@@ -16,10 +16,24 @@
 #include <spl.h>
 #include <uw-vmstats.h>
 
+#if OPT_A3
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+
+/* Counters for tracking statistics, one set per CPU.
+ * A CPU only ever writes its own set, at splhigh so that an interrupt
+ * handler counting something on the same CPU can't lose an update.
+ * Readers add up all the sets without locking; each counter is a
+ * single word, so they at worst miss an increment in flight.
+ */
+static unsigned int stats_percpu[MAXCPUS][VMSTAT_COUNT];
+#else
 /* Counters for tracking statistics */
 static unsigned int stats_counts[VMSTAT_COUNT];
 
 struct spinlock stats_lock = SPINLOCK_INITIALIZER;
+#endif
 
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
@@ -33,6 +47,21 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+#if OPT_A3
+ /* 10 */ "Faults in Text",
+ /* 11 */ "Faults in Data",
+ /* 12 */ "Faults in Heap",
+ /* 13 */ "Faults in Stack",
+ /* 14 */ "Faults in Mappings",
+ /* 15 */ "COW Breaks (Copied)",
+ /* 16 */ "COW Breaks (Reused)",
+ /* 17 */ "Evictions (Clean)",
+ /* 18 */ "Evictions (Dirty)",
+ /* 19 */ "Fault-around Loads",
+ /* 20 */ "Fault-around Hits",
+ /* 21 */ "Pages Prefetched",
+ /* 22 */ "Pages Dropped (DONTNEED)",
+#endif
 };
 
 
@@ -41,15 +70,29 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
+#if OPT_A3
+  int spl;
+
+  spl = splhigh();
+    _vmstats_inc(index);
+  splx(spl);
+#else
     spinlock_acquire(&stats_lock);
       _vmstats_inc(index);
     spinlock_release(&stats_lock);
+#endif
 }
 
 /* ---------------------------------------------------------------------- */
 void
 vmstats_init(void)
 {
+#if OPT_A3
+  /* Nothing to lock; a reset may race with increments on other CPUs,
+   * which then count towards the new totals or are lost.
+   */
+  _vmstats_init();
+#else
   /* Although the spinlock is initialized at declaration time we do it here
    * again in case we want use/reset these stats repeatedly without shutting down the kernel.
    */
@@ -58,6 +101,7 @@ vmstats_init(void)
   spinlock_acquire(&stats_lock);
     _vmstats_init();
   spinlock_release(&stats_lock);
+#endif
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,7 +109,11 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
+#if OPT_A3
+  stats_percpu[curcpu->c_number][index]++;
+#else
   stats_counts[index]++;
+#endif
 }
 
 /* ---------------------------------------------------------------------- */
@@ -80,12 +128,60 @@ _vmstats_init(void)
     panic("Should really fix this before proceeding\n");
   }
 
+#if OPT_A3
+  {
+    int cpu;
+
+    for (cpu=0; cpu<MAXCPUS; cpu++) {
+      for (i=0; i<VMSTAT_COUNT; i++) {
+        stats_percpu[cpu][i] = 0;
+      }
+    }
+  }
+#else
   for (i=0; i<VMSTAT_COUNT; i++) {
     stats_counts[i] = 0;
   }
+#endif
+
+}
 
+#if OPT_A3
+/* ---------------------------------------------------------------------- */
+void
+vmstats_snapshot(unsigned int *counts)
+{
+  int cpu, i;
+
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    counts[i] = 0;
+  }
+  for (cpu=0; cpu<MAXCPUS; cpu++) {
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      counts[i] += stats_percpu[cpu][i];
+    }
+  }
 }
 
+/* ---------------------------------------------------------------------- */
+/* The counters wrap, and may have been reset in between, so a change
+ * is printed as signed.
+ */
+void
+vmstats_printdelta(const unsigned int *before, const unsigned int *after)
+{
+  int i = 0;
+  int delta;
+
+  kprintf("VMSTATS (change since last snapshot):\n");
+  for (i=0; i<VMSTAT_COUNT; i++) {
+    delta = (int)(after[i] - before[i]);
+    kprintf("VMSTAT %25s = %10u (%s%d)\n", stats_names[i], after[i],
+      delta >= 0 ? "+" : "", delta);
+  }
+}
+#endif
+
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
 /* NOTE: We do not grab the spinlock here because kprintf may block
@@ -96,6 +192,9 @@ _vmstats_init(void)
 void
 vmstats_print(void)
 {
+#if OPT_A3
+  unsigned int stats_counts[VMSTAT_COUNT];
+#endif
   int i = 0;
   int free_plus_replace = 0;
   int disk_plus_zeroed_plus_reload = 0;
@@ -103,6 +202,10 @@ vmstats_print(void)
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
 
+#if OPT_A3
+  vmstats_snapshot(stats_counts);
+#endif
+
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
     kprintf("VMSTAT %25s = %10d\n", stats_names[i], stats_counts[i]);
@@ -133,5 +236,13 @@ vmstats_print(void)
     kprintf("WARNING: ELF File reads + Swapfile reads != Page Faults (Disk) %d\n",
       elf_plus_swap_reads);
   }
+
+#if OPT_A3
+  if (stats_counts[VMSTAT_FAULTAROUND_LOAD] > 0) {
+    kprintf("VMSTAT Fault-around hit rate = %u%%\n",
+      stats_counts[VMSTAT_FAULTAROUND_HIT] * 100 /
+      stats_counts[VMSTAT_FAULTAROUND_LOAD]);
+  }
+#endif
 }
 /* ---------------------------------------------------------------------- */
@@ -0,0 +1,292 @@
+/*
+ * TLB slot management. See vmtlb.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <mips/tlb.h>
+#include <vmtlb.h>
+#include <uw-vmstats.h>
+
+/*
+ * One CPU's view of its TLB. Only touched by that CPU, at splhigh,
+ * so there is no lock.
+ */
+struct tlbshadow {
+	uint32_t ts_ehi[NUM_TLB];	/* what we loaded into each slot */
+	bool ts_inuse[NUM_TLB];
+	bool ts_ref[NUM_TLB];		/* used since the clock hand passed */
+	unsigned ts_free[NUM_TLB];	/* stack of free slots */
+	unsigned ts_nfree;
+	unsigned ts_hand;		/* next victim for fifo and clock */
+	unsigned ts_policy;		/* policy the contents were loaded under */
+
+	/* counters */
+	unsigned ts_loads;
+	unsigned ts_replaced;
+	unsigned ts_spared;		/* second chances given by the clock */
+	unsigned ts_flushes;
+};
+
+static struct tlbshadow tlb_shadows[MAXCPUS];
+static volatile unsigned tlb_policy = TLBPOLICY_RANDOM;
+
+static const char *const tlb_policynames[] = {
+	"random",
+	"fifo",
+	"clock",
+};
+
+/* Forget everything in TS; the caller has cleared the hardware. */
+static
+void
+shadow_reset(struct tlbshadow *ts)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_TLB; i++) {
+		ts->ts_inuse[i] = false;
+		ts->ts_ref[i] = false;
+		/* so slot 0 comes off the stack first */
+		ts->ts_free[i] = NUM_TLB - 1 - i;
+	}
+	ts->ts_nfree = NUM_TLB;
+	ts->ts_hand = 0;
+	ts->ts_policy = tlb_policy;
+}
+
+/* Invalidate the hardware TLB and the shadow. Called at splhigh. */
+static
+void
+shadow_flush(struct tlbshadow *ts)
+{
+	int i;
+
+	for (i = 0; i < NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	shadow_reset(ts);
+	ts->ts_flushes++;
+	vmstats_inc(VMSTAT_TLB_INVALIDATE);
+}
+
+/*
+ * Return this CPU's shadow, starting over if the policy has changed
+ * since it was filled. Called at splhigh.
+ */
+static
+struct tlbshadow *
+shadow_get(void)
+{
+	struct tlbshadow *ts;
+
+	ts = &tlb_shadows[curcpu->c_number];
+	if (ts->ts_policy != tlb_policy) {
+		shadow_flush(ts);
+	}
+	return ts;
+}
+
+/*
+ * Pick the slot to evict when none is free. Called at splhigh with
+ * every slot in use.
+ */
+static
+unsigned
+shadow_victim(struct tlbshadow *ts)
+{
+	uint32_t ehi, elo;
+	unsigned i;
+
+	switch (ts->ts_policy) {
+	    case TLBPOLICY_FIFO:
+		i = ts->ts_hand;
+		ts->ts_hand = (i + 1) % NUM_TLB;
+		return i;
+
+	    case TLBPOLICY_CLOCK:
+		/* At most one full turn: the bits we clear stay clear. */
+		while (1) {
+			i = ts->ts_hand;
+			ts->ts_hand = (i + 1) % NUM_TLB;
+			if (!ts->ts_ref[i]) {
+				return i;
+			}
+			ts->ts_ref[i] = false;
+			ts->ts_spared++;
+			tlb_read(&ehi, &elo, i);
+			tlb_write(ehi, elo & ~TLBLO_VALID, i);
+		}
+	}
+	panic("vmtlb: bad policy %u\n", ts->ts_policy);
+}
+
+void
+vmtlb_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < MAXCPUS; i++) {
+		shadow_reset(&tlb_shadows[i]);
+	}
+}
+
+void
+vmtlb_flush(void)
+{
+	int spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+	shadow_flush(&tlb_shadows[curcpu->c_number]);
+	splx(spl);
+}
+
+bool
+vmtlb_drop(uint32_t ehi)
+{
+	struct tlbshadow *ts;
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	ts = shadow_get();
+	i = tlb_probe(ehi, 0);
+	if (i < 0) {
+		splx(spl);
+		return false;
+	}
+	tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	if (ts->ts_inuse[i]) {
+		ts->ts_inuse[i] = false;
+		ts->ts_free[ts->ts_nfree++] = i;
+	}
+
+	splx(spl);
+	return true;
+}
+
+bool
+vmtlb_load(uint32_t ehi, uint32_t elo)
+{
+	struct tlbshadow *ts;
+	bool replaced;
+	int i, spl;
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	ts = shadow_get();
+	ts->ts_loads++;
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		/* e.g. read-only to writable, or back from the clock */
+		tlb_write(ehi, elo, i);
+		ts->ts_ref[i] = ts->ts_inuse[i];
+		splx(spl);
+		return false;
+	}
+
+	replaced = false;
+	if (ts->ts_nfree > 0) {
+		i = ts->ts_free[--ts->ts_nfree];
+		tlb_write(ehi, elo, i);
+	}
+	else if (ts->ts_policy == TLBPOLICY_RANDOM) {
+		/*
+		 * Handling a Full TLB.
+		 * Allow the hardware to choose a random entry to be
+		 * overwritten, then ask it which one that was.
+		 */
+		tlb_random(ehi, elo);
+		i = tlb_probe(ehi, 0);
+		KASSERT(i >= 0);
+		replaced = true;
+	}
+	else {
+		i = shadow_victim(ts);
+		tlb_write(ehi, elo, i);
+		replaced = true;
+	}
+	if (replaced) {
+		ts->ts_replaced++;
+	}
+	ts->ts_ehi[i] = ehi;
+	ts->ts_inuse[i] = true;
+	ts->ts_ref[i] = true;
+
+	splx(spl);
+	return replaced;
+}
+
+/*
+ * The UTLB refill handler loads entries behind the shadows' backs, so
+ * it must stop at once when we leave random, not at each CPU's next
+ * as_activate. Every CPU, ours included, gets a flush IPI, which
+ * starts its shadow over and (see vm_tlbshootdown_all) turns off its
+ * refill handler if the new policy doesn't allow it. Waiting on
+ * whichever CPU we end up on just takes the IPI there.
+ */
+int
+vmtlb_setpolicy(const char *name)
+{
+	struct cpu *c;
+	unsigned i;
+
+	for (i = 0; i < sizeof(tlb_policynames) / sizeof(tlb_policynames[0]);
+	     i++) {
+		if (!strcmp(name, tlb_policynames[i])) {
+			break;
+		}
+	}
+	if (i == sizeof(tlb_policynames) / sizeof(tlb_policynames[0])) {
+		return EINVAL;
+	}
+	if (i == tlb_policy) {
+		return 0;
+	}
+	tlb_policy = i;
+
+	for (i = 0; (c = cpu_bynumber(i)) != NULL; i++) {
+		ipi_tlbshootdown_batch(c, NULL, 0);
+	}
+	for (i = 0; (c = cpu_bynumber(i)) != NULL; i++) {
+		ipi_tlbshootdown_wait(c);
+	}
+	return 0;
+}
+
+bool
+vmtlb_fastrefill(void)
+{
+	return tlb_policy == TLBPOLICY_RANDOM;
+}
+
+void
+vmtlb_printstats(void)
+{
+	struct tlbshadow *ts;
+	unsigned i;
+
+	/* Unlocked: the counters belong to their CPUs. */
+	kprintf("TLB replacement policy: %s%s\n",
+		tlb_policynames[tlb_policy],
+		vmtlb_fastrefill() ? " (with fast refill)" : "");
+	for (i = 0; i < MAXCPUS; i++) {
+		ts = &tlb_shadows[i];
+		if (ts->ts_loads == 0 && ts->ts_flushes == 0) {
+			continue;
+		}
+		kprintf("    cpu%u: %u of %u slots in use, %u loads, "
+			"%u replaced, %u spared, %u flushes\n",
+			i, NUM_TLB - ts->ts_nfree, NUM_TLB, ts->ts_loads,
+			ts->ts_replaced, ts->ts_spared, ts->ts_flushes);
+	}
+}
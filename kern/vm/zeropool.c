@@ -0,0 +1,205 @@
+/*
+ * Pre-zeroed frame pool and the thread that fills it. See zeropool.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <clock.h>
+#include <cpu.h>
+#include <current.h>
+#include <thread.h>
+#include <threadlist.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zeropool.h>
+
+static paddr_t zp_frames[ZEROPOOL_SIZE];
+static unsigned zp_count;
+static unsigned zp_target;	/* fill the pool up to here */
+static unsigned zp_reserve;	/* leave at least this many frames free */
+static bool zp_sleeping;	/* the thread is waiting on zp_wchan */
+
+/* Counters; zp_thread and zp_sync also time the bzero calls. */
+struct zerotime {
+	unsigned zt_pages;
+	time_t zt_secs;
+	uint32_t zt_nsecs;
+};
+static unsigned zp_hits, zp_misses;
+static struct zerotime zp_thread, zp_sync;
+
+static struct wchan *zp_wchan;
+static struct spinlock zp_lock = SPINLOCK_INITIALIZER;
+
+/* Zero the frame at PADDR, charging the time to ZT. */
+static
+void
+zero_timed(paddr_t paddr, struct zerotime *zt)
+{
+	time_t s1, s2, secs;
+	uint32_t ns1, ns2, nsecs;
+
+	gettime(&s1, &ns1);
+	bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+
+	spinlock_acquire(&zp_lock);
+	zt->zt_pages++;
+	zt->zt_secs += secs;
+	zt->zt_nsecs += nsecs;
+	if (zt->zt_nsecs >= 1000000000) {
+		zt->zt_nsecs -= 1000000000;
+		zt->zt_secs++;
+	}
+	spinlock_release(&zp_lock);
+}
+
+/*
+ * Keep the pool topped up. There are no thread priorities, so to stay
+ * out of the way we only zero a page when nothing else is waiting to
+ * run on this CPU, and otherwise nap for a tick.
+ */
+static
+void
+zeropool_thread(void *data1, unsigned long data2)
+{
+	paddr_t paddr;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		spinlock_acquire(&zp_lock);
+		while (zp_count >= zp_target ||
+		       coremap_freeframes() < zp_reserve) {
+			zp_sleeping = true;
+			wchan_lock(zp_wchan);
+			spinlock_release(&zp_lock);
+			wchan_sleep(zp_wchan);
+			spinlock_acquire(&zp_lock);
+		}
+		spinlock_release(&zp_lock);
+
+		if (!threadlist_isempty(&curcpu->c_runqueue)) {
+			clocknap(1);
+			continue;
+		}
+
+		paddr = coremap_alloc(1);
+		if (paddr == 0) {
+			clocknap(1);
+			continue;
+		}
+		zero_timed(paddr, &zp_thread);
+
+		spinlock_acquire(&zp_lock);
+		if (zp_count < ZEROPOOL_SIZE) {
+			zp_frames[zp_count++] = paddr;
+			paddr = 0;
+		}
+		spinlock_release(&zp_lock);
+
+		if (paddr != 0) {
+			/* drained and refilled behind our back */
+			coremap_free(paddr);
+		}
+	}
+}
+
+void
+zeropool_bootstrap(void)
+{
+	int result;
+
+	zp_target = coremap_nframes() / 16;
+	if (zp_target > ZEROPOOL_SIZE) {
+		zp_target = ZEROPOOL_SIZE;
+	}
+	zp_reserve = coremap_nframes() / 8;
+
+	zp_wchan = wchan_create("zeropool");
+	if (zp_wchan == NULL) {
+		panic("zeropool: wchan_create failed\n");
+	}
+
+	result = thread_fork("pagezero", NULL, zeropool_thread, NULL, 0);
+	if (result) {
+		panic("zeropool: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+paddr_t
+zeropool_get(void)
+{
+	paddr_t paddr;
+
+	spinlock_acquire(&zp_lock);
+	if (zp_count > 0) {
+		paddr = zp_frames[--zp_count];
+		zp_hits++;
+	}
+	else {
+		paddr = 0;
+		zp_misses++;
+	}
+	if (zp_sleeping && zp_count < zp_target / 2) {
+		zp_sleeping = false;
+		wchan_wakeone(zp_wchan);
+	}
+	spinlock_release(&zp_lock);
+
+	return paddr;
+}
+
+void
+zeropool_zero(paddr_t paddr)
+{
+	zero_timed(paddr, &zp_sync);
+}
+
+unsigned
+zeropool_drain(void)
+{
+	paddr_t frames[ZEROPOOL_SIZE];
+	unsigned i, n;
+
+	spinlock_acquire(&zp_lock);
+	n = zp_count;
+	for (i = 0; i < n; i++) {
+		frames[i] = zp_frames[i];
+	}
+	zp_count = 0;
+	spinlock_release(&zp_lock);
+
+	for (i = 0; i < n; i++) {
+		coremap_free(frames[i]);
+	}
+	return n;
+}
+
+void
+zeropool_printstats(void)
+{
+	struct zerotime thr, syn;
+	unsigned count, hits, misses;
+
+	spinlock_acquire(&zp_lock);
+	count = zp_count;
+	hits = zp_hits;
+	misses = zp_misses;
+	thr = zp_thread;
+	syn = zp_sync;
+	spinlock_release(&zp_lock);
+
+	kprintf("Zero pool: %u of %u frames ready, %u hits, %u misses\n",
+		count, zp_target, hits, misses);
+	kprintf("    zeroed in background: %u pages in %lu.%09lu seconds\n",
+		thr.zt_pages, (unsigned long) thr.zt_secs,
+		(unsigned long) thr.zt_nsecs);
+	kprintf("    zeroed on demand:     %u pages in %lu.%09lu seconds\n",
+		syn.zt_pages, (unsigned long) syn.zt_secs,
+		(unsigned long) syn.zt_nsecs);
+}
@@ -0,0 +1,24 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_, MAP_, MS_ and MADV_ #defines from the kernel.
+ */
+#include <kern/mman.h>
+
+#define MAP_FAILED ((void *)-1)
+
+/*
+ * Memory-mapped files. OS/161 has no file descriptors to speak of in
+ * the kernel, so mmap takes a path and maps the file from its start;
+ * the address is chosen by the kernel. Only whole mappings can be
+ * unmapped.
+ */
+void *mmap(const char *path, size_t len, int prot, int flags);
+int munmap(void *addr, size_t len);
+int msync(void *addr, size_t len, int flags);
+int madvise(void *addr, size_t len, int advice);
+
+#endif /* _SYS_MMAN_H_ */
@@ -0,0 +1,17 @@
+#ifndef _SYS_RESOURCE_H_
+#define _SYS_RESOURCE_H_
+
+#include <sys/types.h>
+#include <kern/time.h>
+
+/*
+ * Get struct memusage (and the rest) from the kernel.
+ */
+#include <kern/resource.h>
+
+/*
+ * Fill in *USAGE for process PID, or for the caller if PID is 0.
+ */
+int getmemusage(pid_t pid, struct memusage *usage);
+
+#endif /* _SYS_RESOURCE_H_ */
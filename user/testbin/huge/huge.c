@@ -35,10 +35,16 @@
  *
  * When the VM system assignment is done, your system should be able
  * to run this successfully.
+ *
+ * Run as "huge seq" to tell the kernel first (madvise) that the array
+ * is swept in order, to compare the VM counters with and without.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #define PageSize	4096
 #define NumPages	512
@@ -46,12 +52,20 @@
 int sparse[NumPages][PageSize];	/* use only the first element in the row */
 
 int
-main()
+main(int argc, char **argv)
 {
 	int i,j;
+	uintptr_t start;
 
 	printf("Entering the huge program - I will stress test your VM\n");
 
+	if (argc > 1 && !strcmp(argv[1], "seq")) {
+		start = (uintptr_t)sparse & ~(uintptr_t)(PageSize - 1);
+		if (madvise((void *)start, sizeof(sparse), MADV_SEQUENTIAL)) {
+			printf("madvise failed\n");
+		}
+	}
+
 	/* move number in so that sparse[i][0]=i */
 	for (i=0; i<NumPages; i++) {
 		sparse[i][0]=i;
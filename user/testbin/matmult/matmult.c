@@ -37,10 +37,17 @@
  *
  *    Once the VM system assignment is complete your system should be
  *    able to survive this.
+ *
+ *    Run as "matmult seq" to tell the kernel first (madvise) that the
+ *    arrays are swept in order, to compare the VM counters with and
+ *    without.
  */
 
 #include <unistd.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #define Dim 	72	/* sum total of the arrays doesn't fit in 
 			 * physical memory 
@@ -54,9 +61,17 @@ int C[Dim][Dim];
 int T[Dim][Dim][Dim];
 
 int
-main()
+main(int argc, char **argv)
 {
     int i, j, k, r;
+    uintptr_t start;
+
+    if (argc > 1 && !strcmp(argv[1], "seq")) {
+	start = (uintptr_t)T & ~(uintptr_t)4095;
+	if (madvise((void *)start, sizeof(T), MADV_SEQUENTIAL)) {
+	    printf("madvise failed\n");
+	}
+    }
 
     for (i = 0; i < Dim; i++)		/* first initialize the matrices */
 	for (j = 0; j < Dim; j++) {
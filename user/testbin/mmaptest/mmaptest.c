@@ -0,0 +1,267 @@
+/*
+ * mmaptest.c
+ *
+ *	Tests mmap, munmap, msync and madvise on a file.
+ *
+ * This kernel has no open, read or remove, so the file has to exist
+ * already and everything is checked through mappings. Its contents
+ * are saved first and put back at the end.
+ *
+ * A shared writable mapping is written through and synced with msync;
+ * a forked child maps the file again, must see those writes, and
+ * writes its own, which the parent must see. Once both have unmapped
+ * it nothing holds the file's pages, so a fresh mapping reads them
+ * from the file and must show the child's writes. A private mapping
+ * is then written, also in a forked child, and the file must not
+ * have changed. Last, the error returns of munmap, msync and madvise
+ * are checked.
+ *
+ * Usage: mmaptest file    (at least FileSize bytes, and writable)
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/mman.h>
+
+#define PageSize	4096
+#define FileSize	(2 * PageSize + 100)	/* ends part way into a page */
+
+static const char *file;
+static char saved[FileSize];
+
+/* Byte I of the pattern numbered GEN. */
+static
+char
+pattern(int gen, int i)
+{
+	return 'a' + (gen * 7 + i) % 26;
+}
+
+static
+void
+fill(char *p, int gen)
+{
+	int i;
+
+	for (i = 0; i < FileSize; i++) {
+		p[i] = pattern(gen, i);
+	}
+}
+
+static
+void
+check(const char *p, int gen, const char *what)
+{
+	int i;
+
+	for (i = 0; i < FileSize; i++) {
+		if (p[i] != pattern(gen, i)) {
+			errx(1, "%s: byte %d is %d, expected %d",
+			     what, i, p[i], pattern(gen, i));
+		}
+	}
+}
+
+static
+char *
+map(int prot, int flags, const char *what)
+{
+	char *p;
+
+	p = mmap(file, FileSize, prot, flags);
+	if (p == MAP_FAILED) {
+		err(1, "%s: mmap %s", file, what);
+	}
+	return p;
+}
+
+static
+void
+unmap(char *p, const char *what)
+{
+	if (munmap(p, FileSize)) {
+		err(1, "munmap %s", what);
+	}
+}
+
+/*
+ * Map the file afresh and check it holds pattern GEN. Only call this
+ * when nothing else maps it, so its pages come from the file.
+ */
+static
+void
+checkfile(int gen, const char *what)
+{
+	char *p;
+
+	p = map(PROT_READ, MAP_PRIVATE, what);
+	check(p, gen, what);
+	unmap(p, what);
+}
+
+/* Wait for child PID and fail unless it exited with 0. */
+static
+void
+waitchild(pid_t pid, const char *what)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "%s: child failed", what);
+	}
+}
+
+/* Check that a call returned -1 with errno set to WANT. */
+static
+void
+expect(int result, int want, const char *what)
+{
+	if (result != -1) {
+		errx(1, "%s: returned %d, expected failure", what, result);
+	}
+	if (errno != want) {
+		errx(1, "%s: error %d (%s), expected %d (%s)", what,
+		     errno, strerror(errno), want, strerror(want));
+	}
+}
+
+static
+void
+test_shared(void)
+{
+	char *p, *q;
+	pid_t pid;
+
+	p = map(PROT_READ|PROT_WRITE, MAP_SHARED, "shared");
+	fill(p, 1);
+	check(p, 1, "shared mapping");
+	if (msync(p, FileSize, MS_SYNC)) {
+		err(1, "msync");
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		q = map(PROT_READ|PROT_WRITE, MAP_SHARED, "in child");
+		check(q, 1, "second shared mapping");
+		fill(q, 2);
+		if (msync(q, FileSize, MS_SYNC)) {
+			err(1, "msync in child");
+		}
+		unmap(q, "in child");
+		_exit(0);
+	}
+	waitchild(pid, "shared");
+
+	check(p, 2, "shared mapping after child");
+	unmap(p, "shared");
+	checkfile(2, "file after shared munmap");
+	printf("shared mapping passed\n");
+}
+
+static
+void
+test_private(void)
+{
+	char *p;
+	pid_t pid;
+
+	/* Writes stay in the mapping, even across msync. */
+	p = map(PROT_READ|PROT_WRITE, MAP_PRIVATE, "private");
+	check(p, 2, "private mapping");
+	fill(p, 3);
+	if (msync(p, FileSize, MS_SYNC)) {
+		err(1, "msync private");
+	}
+
+	/* A child gets its own copy. */
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		check(p, 3, "private mapping in child");
+		fill(p, 4);
+		_exit(0);
+	}
+	waitchild(pid, "private");
+	check(p, 3, "private mapping after child");
+
+	/* DONTNEED drops the private copy; the file shows through. */
+	if (madvise(p, FileSize, MADV_DONTNEED)) {
+		err(1, "madvise DONTNEED");
+	}
+	check(p, 2, "private mapping after DONTNEED");
+	fill(p, 3);
+	unmap(p, "private");
+	checkfile(2, "file after private munmap");
+	printf("private mapping passed\n");
+}
+
+static
+void
+test_errors(void)
+{
+	char *p;
+
+	p = map(PROT_READ, MAP_PRIVATE, "read-only");
+	if (madvise(p, FileSize, MADV_WILLNEED)) {
+		err(1, "madvise WILLNEED");
+	}
+	check(p, 2, "mapping after WILLNEED");
+
+	expect(munmap(p + 1, FileSize), EINVAL, "munmap unaligned");
+	expect(munmap(p, FileSize + PageSize), EINVAL, "munmap too long");
+	expect(munmap(p + PageSize, PageSize), EINVAL, "munmap part");
+	expect(msync(p + 1, FileSize, MS_SYNC), EINVAL, "msync unaligned");
+	expect(msync(p, FileSize, 8), EINVAL, "msync bad flags");
+	expect(madvise(p + 1, FileSize, MADV_NORMAL), EINVAL,
+	       "madvise unaligned");
+	expect(madvise(p, FileSize, 99), EINVAL, "madvise bad advice");
+	expect(madvise(p, (size_t)-1, MADV_NORMAL), ENOMEM,
+	       "madvise wrapping");
+	expect(msync(p, (size_t)-1, MS_SYNC), ENOMEM, "msync wrapping");
+
+	unmap(p, "read-only");
+	expect(munmap(p, FileSize), EINVAL, "munmap twice");
+	expect(madvise(p, FileSize, MADV_NORMAL), ENOMEM,
+	       "madvise unmapped");
+	printf("error returns passed\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	char *p;
+
+	if (argc != 2) {
+		errx(1, "Usage: mmaptest <filename>");
+	}
+	file = argv[1];
+
+	p = map(PROT_READ, MAP_PRIVATE, "to save");
+	memcpy(saved, p, FileSize);
+	unmap(p, "to save");
+
+	test_shared();
+	test_private();
+	test_errors();
+
+	p = map(PROT_READ|PROT_WRITE, MAP_SHARED, "to restore");
+	memcpy(p, saved, FileSize);
+	unmap(p, "to restore");
+
+	printf("mmaptest done.\n");
+	return 0;
+}